@@ -1,961 +1,5538 @@
 #include <iostream>
 #include <array>
 #include <vector>
+#include <deque>
 #include <string>
 #include <fstream>
 #include <algorithm>
 #include <cstdlib>
 #include <thread>
 #include <chrono>
-#include <unordered_map>
 #include <cmath>
 #include <filesystem>
 #include <ctime>
 #include <cstdio>
+#include <sstream>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string_view>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "ws2_32.lib") // MinGW: link with -lws2_32
+#endif
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <xmmintrin.h>
+#endif
+#if defined(__BMI2__) || defined(USE_PEXT)
+#include <immintrin.h>
+#ifndef USE_PEXT
+#define USE_PEXT
+#endif
+#endif
+// x86-64: the NNUE kernels are built for SSE2 and AVX2 and chosen at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define NNUE_X86
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 using Board = std::array<char, 64>;
+using Bitboard = uint64_t;
 
+enum Color
+{
+    WHITE = 0,
+    BLACK = 1
+};
+
+enum PieceType
+{
+    PAWN = 0,
+    KNIGHT,
+    BISHOP,
+    ROOK,
+    QUEEN,
+    KING,
+    NO_PIECE_TYPE
+};
+
+// Move flags stored in the top 4 bits of a Move
+enum MoveFlag
+{
+    FLAG_QUIET = 0,
+    FLAG_DOUBLE_PUSH = 1,
+    FLAG_KING_CASTLE = 2,
+    FLAG_QUEEN_CASTLE = 3,
+    FLAG_CAPTURE = 4,
+    FLAG_EN_PASSANT = 5,
+    FLAG_PROMOTION = 8,         // + 0..3 for knight, bishop, rook, queen
+    FLAG_PROMOTION_CAPTURE = 12 // + 0..3 for knight, bishop, rook, queen
+};
+
+// 16-bit packed move: from (bits 0-5) | to (bits 6-11) | flags (bits 12-15).
+// Default construction leaves it uninitialized so move lists cost nothing to set up;
+// Move() with no data, i.e. Move{}, is the null move.
 struct Move
 {
-    int from;
-    int to;
-    bool isCapture;
-    char promotion; // 'Q', 'R', 'B', 'N' or '\0'
+    uint16_t data;
+
+    Move() = default;
+    Move(int from, int to, int flags = FLAG_QUIET) : data((uint16_t)(from | (to << 6) | (flags << 12))) {}
+    static Move fromData(uint16_t d)
+    {
+        Move m;
+        m.data = d;
+        return m;
+    }
+
+    int from() const { return data & 63; }
+    int to() const { return (data >> 6) & 63; }
+    int flags() const { return data >> 12; }
+    bool isCapture() const { return (flags() & FLAG_CAPTURE) != 0; } // capture, en passant and capturing promotions
+    bool isPromotion() const { return (flags() & FLAG_PROMOTION) != 0; }
+    int promotionType() const { return KNIGHT + (flags() & 3); } // only meaningful if isPromotion()
+    bool isEnPassant() const { return flags() == FLAG_EN_PASSANT; }
+    bool isCastle() const { return flags() == FLAG_KING_CASTLE || flags() == FLAG_QUEEN_CASTLE; }
+    bool isNull() const { return data == 0; }
+    bool operator==(const Move &o) const { return data == o.data; }
+    bool operator!=(const Move &o) const { return data != o.data; }
+};
+static_assert(sizeof(Move) == 2, "Move must stay packed in 16 bits");
+
+const int MAX_MOVES = 256; // more than the legal moves of any reachable position
+
+// Fixed-capacity move list living on the stack; no heap allocation on the search path.
+// `scores` is only filled by the search (scoreMoves) for move ordering.
+struct MoveList
+{
+    Move moves[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int count = 0;
+
+    void push(Move m) { moves[count++] = m; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    Move &operator[](int i) { return moves[i]; }
+    const Move &operator[](int i) const { return moves[i]; }
+    Move *begin() { return moves; }
+    Move *end() { return moves + count; }
+    const Move *begin() const { return moves; }
+    const Move *end() const { return moves + count; }
+
+    // lazy selection sort: swap the best scored move of [i, count) into slot i and return it
+    Move pickNext(int i)
+    {
+        int best = i;
+        for (int j = i + 1; j < count; ++j)
+            if (scores[j] > scores[best])
+                best = j;
+        std::swap(moves[i], moves[best]);
+        std::swap(scores[i], scores[best]);
+        return moves[i];
+    }
+};
+
+const int NNUE_FEATURES = 768; // [color relative to the perspective][pieceType][square]
+const int NNUE_HIDDEN = 256;
+
+// NNUE first layer per perspective (white, black)
+struct NnueAccumulator
+{
+    alignas(32) int16_t v[2][NNUE_HIDDEN];
 };
 
 struct GameState
 {
     Board board;
+    // bitboards kept in sync with `board`: pieces[color][pieceType], occupancy[color]
+    Bitboard pieces[2][6] = {};
+    Bitboard occupancy[2] = {};
     bool whiteCastleK = true;
     bool whiteCastleQ = true;
     bool blackCastleK = true;
     bool blackCastleQ = true;
-    int enPassant = -1; // square index that can be captured into, or -1
+    int enPassant = -1;     // square index that can be captured into, or -1
+    int halfmoveClock = 0;  // halfmoves since last pawn move or capture
+    int fullmoveNumber = 1; // incremented after each black move
+    uint64_t key = 0;       // Zobrist hash, maintained incrementally by putPiece/removePiece/makeMove
+    // evaluation terms, maintained incrementally by putPiece/removePiece
+    int material[2] = {};   // pieceMaterial points per color
+    int psqMg = 0;          // middlegame piece values + piece-square scores, white minus black
+    int psqEg = 0;          // endgame piece values + piece-square scores, white minus black
+    int phase = 0;          // 0 (bare kings and pawns) .. PHASE_MAX (all pieces), may exceed with promotions
+    // current slot of a search's accumulator stack, maintained by putPiece/removePiece and
+    // makeMove/unmakeMove; null unless a search evaluates with the network
+    NnueAccumulator *accumulator = nullptr;
 };
 
 // Helpers
 bool isWhite(char p) { return p >= 'A' && p <= 'Z'; }
 bool isBlack(char p) { return p >= 'a' && p <= 'z'; }
 
-void addMove(std::vector<Move> &moves, int from, int to, bool isCapture = false, char promotion = '\0')
+int pieceTypeOf(char p)
 {
-    moves.push_back({from, to, isCapture, promotion});
+    switch (p)
+    {
+    case 'P':
+    case 'p':
+        return PAWN;
+    case 'N':
+    case 'n':
+        return KNIGHT;
+    case 'B':
+    case 'b':
+        return BISHOP;
+    case 'R':
+    case 'r':
+        return ROOK;
+    case 'Q':
+    case 'q':
+        return QUEEN;
+    case 'K':
+    case 'k':
+        return KING;
+    default:
+        return NO_PIECE_TYPE;
+    }
 }
 
-std::string squareName(int i)
+// --- Bitboard primitives ---
+inline Bitboard squareBB(int sq) { return 1ULL << sq; }
+
+inline int popCount(Bitboard b)
 {
-    char file = 'a' + (i % 8);
-    char rank = '1' + (i / 8);
-    return std::string() + file + rank;
+#if defined(_MSC_VER)
+    return (int)__popcnt64(b);
+#else
+    return __builtin_popcountll(b);
+#endif
 }
 
-void printBoard(const Board &board)
+// index of least significant set bit; b must be non-zero
+inline int lsb(Bitboard b)
 {
-    for (int rank = 7; rank >= 0; --rank)
-    {
-        for (int file = 0; file < 8; ++file)
-        {
-            std::cout << board[rank * 8 + file] << ' ';
-        }
-        std::cout << std::endl;
-    }
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, b);
+    return (int)idx;
+#else
+    return __builtin_ctzll(b);
+#endif
 }
 
-// Write a simple JSON file representing the board for the web UI
-void writeBoardJson(const GameState &gs, const std::string &path = "web/board.json")
+inline int popLsb(Bitboard &b)
 {
-    std::ofstream f(path);
-    if (!f)
-        return;
-    f << "{\"board\": [";
-    for (int i = 0; i < 64; ++i)
+    int sq = lsb(b);
+    b &= b - 1;
+    return sq;
+}
+
+const Bitboard FileABB = 0x0101010101010101ULL;
+const Bitboard FileHBB = FileABB << 7;
+const Bitboard Rank1BB = 0xFFULL;
+const Bitboard Rank8BB = Rank1BB << 56;
+
+Bitboard knightAttacks[64];
+Bitboard kingAttacks[64];
+Bitboard pawnAttacks[2][64]; // squares attacked by a pawn of [color] standing on [sq]
+
+// Magic bitboard entry for one square. With USE_PEXT the index is taken with
+// the BMI2 pext instruction and `magic`/`shift` are unused.
+struct Magic
+{
+    Bitboard mask;
+    Bitboard magic;
+    Bitboard *attacks;
+    unsigned shift;
+
+    unsigned index(Bitboard occ) const
     {
-        char c = gs.board[i];
-        if (c == '"')
-            c = '\\"';
-        f << '\"' << c << '\"';
-        if (i < 63)
-            f << ',';
+#if defined(USE_PEXT)
+        return (unsigned)_pext_u64(occ, mask);
+#else
+        return (unsigned)(((occ & mask) * magic) >> shift);
+#endif
     }
-    f << "], \"enPassant\": " << gs.enPassant << " }";
-    f.close();
+};
+
+Magic rookMagics[64];
+Magic bishopMagics[64];
+Bitboard rookTable[0x19000];  // 102400 entries for all rook occupancies
+Bitboard bishopTable[0x1480]; // 5248 entries for all bishop occupancies
+
+inline Bitboard bishopAttacks(int sq, Bitboard occ)
+{
+    const Magic &m = bishopMagics[sq];
+    return m.attacks[m.index(occ)];
 }
 
-// Write full game positions as JSON array of boards for the web UI
-void writeGameJson(const std::vector<Board> &positions, const std::string &path = "web/game.json")
+inline Bitboard rookAttacks(int sq, Bitboard occ)
 {
-    std::ofstream f(path);
-    if (!f)
-        return;
-    f << "{\"positions\": [";
-    for (size_t p = 0; p < positions.size(); ++p)
+    const Magic &m = rookMagics[sq];
+    return m.attacks[m.index(occ)];
+}
+
+inline Bitboard queenAttacks(int sq, Bitboard occ) { return bishopAttacks(sq, occ) | rookAttacks(sq, occ); }
+
+// slow ray walk, only used to fill the magic tables at startup
+Bitboard slidingAttack(int sq, Bitboard occ, const int dirs[4][2])
+{
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; ++d)
     {
-        f << '[';
-        for (int i = 0; i < 64; ++i)
+        int nf = sq % 8 + dirs[d][0], nr = sq / 8 + dirs[d][1];
+        while (nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
         {
-            char c = positions[p][i];
-            if (c == '"')
-                c = '\\"';
-            f << '"' << c << '"';
-            if (i < 63)
-                f << ',';
+            Bitboard b = squareBB(nr * 8 + nf);
+            attacks |= b;
+            if (occ & b)
+                break;
+            nf += dirs[d][0];
+            nr += dirs[d][1];
         }
-        f << ']';
-        if (p + 1 < positions.size())
-            f << ',';
     }
-    f << "] }";
-    f.close();
+    return attacks;
 }
 
-// Is square attacked by side 'byWhite'
-bool isSquareAttacked(const Board &board, int sq, bool byWhite)
+// xorshift64* generator for the magic number search and Zobrist keys (fixed seed => same tables every run)
+struct Prng
 {
-    int f = sq % 8;
-    int r = sq / 8;
-    // pawn attacks
-    if (byWhite)
+    uint64_t s;
+    uint64_t next()
     {
-        int rf = r - 1;
-        if (rf >= 0)
-        {
-            if (f - 1 >= 0 && board[rf * 8 + (f - 1)] == 'P')
-                return true;
-            if (f + 1 <= 7 && board[rf * 8 + (f + 1)] == 'P')
-                return true;
-        }
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 2685821657736338717ULL;
     }
-    else
+    // magics with few set bits are found much faster
+    uint64_t sparse() { return next() & next() & next(); }
+};
+
+void initMagics(Bitboard table[], Magic magics[], const int dirs[4][2])
+{
+    static Bitboard reference[4096];
+#if !defined(USE_PEXT)
+    static Bitboard occupancy[4096];
+    static int epoch[4096];
+    // per-rank seeds known to converge quickly with this generator
+    static const uint64_t seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+    int attempt = 0;
+#endif
+    int size = 0;
+
+    for (int sq = 0; sq < 64; ++sq)
     {
-        int rf = r + 1;
-        if (rf <= 7)
+        Magic &m = magics[sq];
+        // board edges are irrelevant for occupancy unless the slider stands on them
+        Bitboard edges = ((Rank1BB | Rank8BB) & ~(Rank1BB << (8 * (sq / 8)))) |
+                         ((FileABB | FileHBB) & ~(FileABB << (sq % 8)));
+        m.mask = slidingAttack(sq, 0, dirs) & ~edges;
+        m.shift = 64 - popCount(m.mask);
+        m.attacks = sq == 0 ? table : magics[sq - 1].attacks + size;
+
+        // enumerate every subset of the mask (carry-rippler)
+        size = 0;
+        Bitboard b = 0;
+        do
         {
-            if (f - 1 >= 0 && board[rf * 8 + (f - 1)] == 'p')
-                return true;
-            if (f + 1 <= 7 && board[rf * 8 + (f + 1)] == 'p')
-                return true;
+            reference[size] = slidingAttack(sq, b, dirs);
+#if defined(USE_PEXT)
+            m.attacks[m.index(b)] = reference[size];
+#else
+            occupancy[size] = b;
+#endif
+            ++size;
+            b = (b - m.mask) & m.mask;
+        } while (b);
+
+#if !defined(USE_PEXT)
+        // search for a magic that maps every subset to a non-conflicting slot
+        Prng rng{seeds[sq / 8]};
+        for (int i = 0; i < size;)
+        {
+            for (m.magic = 0; popCount((m.magic * m.mask) >> 56) < 6;)
+                m.magic = rng.sparse();
+
+            for (++attempt, i = 0; i < size; ++i)
+            {
+                unsigned idx = m.index(occupancy[i]);
+                if (epoch[idx] < attempt)
+                {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                }
+                else if (m.attacks[idx] != reference[i])
+                    break;
+            }
         }
+#endif
     }
+}
+
+// Squares strictly between two aligned squares, and the whole line through them (0 if not aligned)
+Bitboard betweenBB[64][64];
+Bitboard lineBB[64][64];
 
-    // knights
+// Fill the leaper and slider attack tables. Must run once before any move generation.
+void initAttackTables()
+{
     static const int ndf[] = {1, 2, 2, 1, -1, -2, -2, -1};
     static const int ndr[] = {2, 1, -1, -2, -2, -1, 1, 2};
-    for (int k = 0; k < 8; ++k)
-    {
-        int nf = f + ndf[k];
-        int nr = r + ndr[k];
-        if (nf < 0 || nf > 7 || nr < 0 || nr > 7)
-            continue;
-        char c = board[nr * 8 + nf];
-        if (byWhite && c == 'N')
-            return true;
-        if (!byWhite && c == 'n')
-            return true;
-    }
-
-    // sliding rooks/queens
-    const std::pair<int, int> orth[4] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
-    for (auto [df, dr] : orth)
+    for (int sq = 0; sq < 64; ++sq)
     {
-        int nf = f + df, nr = r + dr;
-        while (nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
+        int f = sq % 8, r = sq / 8;
+        knightAttacks[sq] = kingAttacks[sq] = 0;
+        pawnAttacks[WHITE][sq] = pawnAttacks[BLACK][sq] = 0;
+        for (int k = 0; k < 8; ++k)
         {
-            char c = board[nr * 8 + nf];
-            if (c != '.')
+            int nf = f + ndf[k], nr = r + ndr[k];
+            if (nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
+                knightAttacks[sq] |= squareBB(nr * 8 + nf);
+        }
+        for (int df = -1; df <= 1; ++df)
+            for (int dr = -1; dr <= 1; ++dr)
             {
-                if (byWhite && (c == 'R' || c == 'Q'))
-                    return true;
-                if (!byWhite && (c == 'r' || c == 'q'))
-                    return true;
-                break;
+                int nf = f + df, nr = r + dr;
+                if ((df || dr) && nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
+                    kingAttacks[sq] |= squareBB(nr * 8 + nf);
             }
-            nf += df;
-            nr += dr;
+        for (int df = -1; df <= 1; df += 2)
+        {
+            if (f + df < 0 || f + df > 7)
+                continue;
+            if (r < 7)
+                pawnAttacks[WHITE][sq] |= squareBB((r + 1) * 8 + f + df);
+            if (r > 0)
+                pawnAttacks[BLACK][sq] |= squareBB((r - 1) * 8 + f + df);
         }
     }
 
-    // sliding bishops/queens
-    const std::pair<int, int> diag[4] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
-    for (auto [df, dr] : diag)
-    {
-        int nf = f + df, nr = r + dr;
-        while (nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
+    static const int rookDirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    static const int bishopDirs[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+    initMagics(rookTable, rookMagics, rookDirs);
+    initMagics(bishopTable, bishopMagics, bishopDirs);
+
+    for (int a = 0; a < 64; ++a)
+        for (int b = 0; b < 64; ++b)
         {
-            char c = board[nr * 8 + nf];
-            if (c != '.')
+            betweenBB[a][b] = lineBB[a][b] = 0;
+            if (a == b)
+                continue;
+            if (rookAttacks(a, 0) & squareBB(b))
             {
-                if (byWhite && (c == 'B' || c == 'Q'))
-                    return true;
-                if (!byWhite && (c == 'b' || c == 'q'))
-                    return true;
-                break;
+                betweenBB[a][b] = rookAttacks(a, squareBB(b)) & rookAttacks(b, squareBB(a));
+                lineBB[a][b] = (rookAttacks(a, 0) & rookAttacks(b, 0)) | squareBB(a) | squareBB(b);
+            }
+            else if (bishopAttacks(a, 0) & squareBB(b))
+            {
+                betweenBB[a][b] = bishopAttacks(a, squareBB(b)) & bishopAttacks(b, squareBB(a));
+                lineBB[a][b] = (bishopAttacks(a, 0) & bishopAttacks(b, 0)) | squareBB(a) | squareBB(b);
             }
-            nf += df;
-            nr += dr;
         }
-    }
+}
+
+// --- Zobrist hashing ---
+uint64_t zobristPiece[2][6][64];
+uint64_t zobristCastling[16]; // indexed by castlingBits()
+uint64_t zobristEnPassant[8]; // by file of the en passant square
+uint64_t zobristSide;         // xored in when black is to move
+
+void initZobrist()
+{
+    Prng rng{1070372ULL};
+    for (int c = 0; c < 2; ++c)
+        for (int t = 0; t < 6; ++t)
+            for (int sq = 0; sq < 64; ++sq)
+                zobristPiece[c][t][sq] = rng.next();
+    for (int i = 0; i < 16; ++i)
+        zobristCastling[i] = rng.next();
+    for (int f = 0; f < 8; ++f)
+        zobristEnPassant[f] = rng.next();
+    zobristSide = rng.next();
+}
+
+uint8_t castlingBits(const GameState &gs)
+{
+    return (uint8_t)((gs.whiteCastleK ? 1 : 0) | (gs.whiteCastleQ ? 2 : 0) | (gs.blackCastleK ? 4 : 0) | (gs.blackCastleQ ? 8 : 0));
+}
 
-    // king
-    for (int df = -1; df <= 1; ++df)
-        for (int dr = -1; dr <= 1; ++dr)
+void setCastlingBits(GameState &gs, uint8_t bits)
+{
+    gs.whiteCastleK = bits & 1;
+    gs.whiteCastleQ = bits & 2;
+    gs.blackCastleK = bits & 4;
+    gs.blackCastleQ = bits & 8;
+}
+
+// --- Evaluation tables ---
+const int pieceMaterial[6] = {1, 3, 3, 5, 9, 0};
+const int pieceValueMg[6] = {82, 337, 365, 477, 1025, 0};
+const int pieceValueEg[6] = {94, 281, 297, 512, 936, 0};
+const int phaseWeight[6] = {0, 1, 1, 2, 4, 0};
+const int PHASE_MAX = 24;
+
+// Piece-square tables from white's point of view, written with rank 8 on top (index with sq ^ 56)
+const int pawnPsqMg[64] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    50, 50, 50, 50, 50, 50, 50, 50,
+    10, 10, 20, 30, 30, 20, 10, 10,
+    5, 5, 10, 25, 25, 10, 5, 5,
+    0, 0, 0, 20, 20, 0, 0, 0,
+    5, -5, -10, 0, 0, -10, -5, 5,
+    5, 10, 10, -20, -20, 10, 10, 5,
+    0, 0, 0, 0, 0, 0, 0, 0};
+const int pawnPsqEg[64] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    80, 80, 80, 80, 80, 80, 80, 80,
+    50, 50, 50, 50, 50, 50, 50, 50,
+    30, 30, 30, 30, 30, 30, 30, 30,
+    20, 20, 20, 20, 20, 20, 20, 20,
+    10, 10, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 10, 10, 10, 10, 10,
+    0, 0, 0, 0, 0, 0, 0, 0};
+const int knightPsq[64] = {
+    -50, -40, -30, -30, -30, -30, -40, -50,
+    -40, -20, 0, 0, 0, 0, -20, -40,
+    -30, 0, 10, 15, 15, 10, 0, -30,
+    -30, 5, 15, 20, 20, 15, 5, -30,
+    -30, 0, 15, 20, 20, 15, 0, -30,
+    -30, 5, 10, 15, 15, 10, 5, -30,
+    -40, -20, 0, 5, 5, 0, -20, -40,
+    -50, -40, -30, -30, -30, -30, -40, -50};
+const int bishopPsq[64] = {
+    -20, -10, -10, -10, -10, -10, -10, -20,
+    -10, 0, 0, 0, 0, 0, 0, -10,
+    -10, 0, 5, 10, 10, 5, 0, -10,
+    -10, 5, 5, 10, 10, 5, 5, -10,
+    -10, 0, 10, 10, 10, 10, 0, -10,
+    -10, 10, 10, 10, 10, 10, 10, -10,
+    -10, 5, 0, 0, 0, 0, 5, -10,
+    -20, -10, -10, -10, -10, -10, -10, -20};
+const int rookPsq[64] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    5, 10, 10, 10, 10, 10, 10, 5,
+    -5, 0, 0, 0, 0, 0, 0, -5,
+    -5, 0, 0, 0, 0, 0, 0, -5,
+    -5, 0, 0, 0, 0, 0, 0, -5,
+    -5, 0, 0, 0, 0, 0, 0, -5,
+    -5, 0, 0, 0, 0, 0, 0, -5,
+    0, 0, 0, 5, 5, 0, 0, 0};
+const int queenPsq[64] = {
+    -20, -10, -10, -5, -5, -10, -10, -20,
+    -10, 0, 0, 0, 0, 0, 0, -10,
+    -10, 0, 5, 5, 5, 5, 0, -10,
+    -5, 0, 5, 5, 5, 5, 0, -5,
+    0, 0, 5, 5, 5, 5, 0, -5,
+    -10, 5, 5, 5, 5, 5, 0, -10,
+    -10, 0, 5, 0, 0, 0, 0, -10,
+    -20, -10, -10, -5, -5, -10, -10, -20};
+const int kingPsqMg[64] = {
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -30, -40, -40, -50, -50, -40, -40, -30,
+    -20, -30, -30, -40, -40, -30, -30, -20,
+    -10, -20, -20, -20, -20, -20, -20, -10,
+    20, 20, 0, 0, 0, 0, 20, 20,
+    20, 30, 10, 0, 0, 10, 30, 20};
+const int kingPsqEg[64] = {
+    -50, -40, -30, -20, -20, -30, -40, -50,
+    -30, -20, -10, 0, 0, -10, -20, -30,
+    -30, -10, 20, 30, 30, 20, -10, -30,
+    -30, -10, 30, 40, 40, 30, -10, -30,
+    -30, -10, 30, 40, 40, 30, -10, -30,
+    -30, -10, 20, 30, 30, 20, -10, -30,
+    -30, -30, 0, 0, 0, 0, -30, -30,
+    -50, -30, -30, -30, -30, -30, -30, -50};
+
+// piece value + piece-square score per [color][pieceType][square], signed (black negative)
+int psqMg[2][6][64];
+int psqEg[2][6][64];
+
+void initEvalTables()
+{
+    const int *mgTables[6] = {pawnPsqMg, knightPsq, bishopPsq, rookPsq, queenPsq, kingPsqMg};
+    const int *egTables[6] = {pawnPsqEg, knightPsq, bishopPsq, rookPsq, queenPsq, kingPsqEg};
+    for (int t = 0; t < 6; ++t)
+        for (int sq = 0; sq < 64; ++sq)
         {
-            if (df == 0 && dr == 0)
-                continue;
-            int nf = f + df, nr = r + dr;
-            if (nf < 0 || nf > 7 || nr < 0 || nr > 7)
-                continue;
-            char c = board[nr * 8 + nf];
-            if (byWhite && c == 'K')
-                return true;
-            if (!byWhite && c == 'k')
-                return true;
+            // a black piece on sq scores like a white piece on the mirrored square
+            psqMg[WHITE][t][sq] = pieceValueMg[t] + mgTables[t][sq ^ 56];
+            psqEg[WHITE][t][sq] = pieceValueEg[t] + egTables[t][sq ^ 56];
+            psqMg[BLACK][t][sq] = -(pieceValueMg[t] + mgTables[t][sq]);
+            psqEg[BLACK][t][sq] = -(pieceValueEg[t] + egTables[t][sq]);
         }
+}
 
-    return false;
+// --- NNUE evaluation (optional, --nnue <file>) ---
+// A 768 -> 2x256 -> 1 network: each perspective (white, black) sees the pieces as
+// (own/their color, piece type, square flipped for black) features; the accumulators of
+// the side to move and the other side go through a clipped ReLU into one output neuron.
+// Weights file, little endian:
+//   "CNUE" | uint32 version (1) | uint32 hidden size (256)
+//   int16 featureWeights[768][256] | int16 featureBias[256]
+//   int16 outputWeights[2][256] (side to move first) | int32 outputBias
+// Quantization: the first layer is scaled by NNUE_QA, output weights by NNUE_QB and the
+// result is NNUE_SCALE centipawns per unit.
+const int NNUE_QA = 255;
+const int NNUE_QB = 64;
+const int NNUE_SCALE = 400;
+
+struct Network
+{
+    std::vector<int16_t> featureWeights; // NNUE_FEATURES * NNUE_HIDDEN
+    int16_t featureBias[NNUE_HIDDEN];
+    int16_t outputWeights[2 * NNUE_HIDDEN];
+    int32_t outputBias = 0;
+};
+
+Network network;
+bool nnueEnabled = false; // set once a network has been loaded
+
+// Kernels over NNUE_HIDDEN int16 lanes, picked by selectNnueKernels
+void (*nnueAdd)(int16_t *acc, const int16_t *w) = nullptr;
+void (*nnueSub)(int16_t *acc, const int16_t *w) = nullptr;
+int32_t (*nnueOutput)(const int16_t *us, const int16_t *them, const int16_t *w) = nullptr;
+const char *nnueKernelName = "scalar";
+
+void nnueAddScalar(int16_t *acc, const int16_t *w)
+{
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        acc[i] = (int16_t)(acc[i] + w[i]);
 }
 
-int findKingSquare(const Board &board, bool white)
+void nnueSubScalar(int16_t *acc, const int16_t *w)
 {
-    char K = white ? 'K' : 'k';
-    for (int i = 0; i < 64; ++i)
-        if (board[i] == K)
-            return i;
-    return -1;
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
+        acc[i] = (int16_t)(acc[i] - w[i]);
 }
 
-// Create a key for repetition detection: board + castling rights + enPassant + side to move
-std::string positionKey(const GameState &gs, bool whiteTurn)
+int32_t nnueOutputScalar(const int16_t *us, const int16_t *them, const int16_t *w)
 {
-    std::string k;
-    k.reserve(80);
-    for (int i = 0; i < 64; ++i)
-        k.push_back(gs.board[i]);
-    k.push_back('|');
-    k.push_back(gs.whiteCastleK ? 'K' : '-');
-    k.push_back(gs.whiteCastleQ ? 'Q' : '-');
-    k.push_back(gs.blackCastleK ? 'k' : '-');
-    k.push_back(gs.blackCastleQ ? 'q' : '-');
-    k.push_back('|');
-    if (gs.enPassant >= 0)
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; ++i)
     {
-        int ep = gs.enPassant;
-        k.push_back('0' + (ep % 8));
-        k.push_back('0' + (ep / 8));
+        sum += std::clamp<int>(us[i], 0, NNUE_QA) * w[i];
+        sum += std::clamp<int>(them[i], 0, NNUE_QA) * w[NNUE_HIDDEN + i];
     }
-    else
+    return sum;
+}
+
+#ifdef NNUE_X86
+void nnueAddSse2(int16_t *acc, const int16_t *w)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i += 8)
     {
-        k.push_back('-');
-        k.push_back('-');
+        __m128i a = _mm_load_si128((const __m128i *)(acc + i));
+        _mm_store_si128((__m128i *)(acc + i), _mm_add_epi16(a, _mm_loadu_si128((const __m128i *)(w + i))));
     }
-    k.push_back('|');
-    k.push_back(whiteTurn ? 'w' : 'b');
-    return k;
 }
 
-// Evaluation: material only
-int evaluate(const Board &board)
+void nnueSubSse2(int16_t *acc, const int16_t *w)
 {
-    int whiteScore = 0, blackScore = 0;
-    for (char p : board)
+    for (int i = 0; i < NNUE_HIDDEN; i += 8)
     {
-        switch (p)
-        {
-        case 'P':
-            whiteScore += 1;
-            break;
-        case 'N':
-        case 'B':
-            whiteScore += 3;
-            break;
-        case 'R':
-            whiteScore += 5;
-            break;
-        case 'Q':
-            whiteScore += 9;
-            break;
-        case 'p':
-            blackScore += 1;
-            break;
-        case 'n':
-        case 'b':
-            blackScore += 3;
-            break;
-        case 'r':
-            blackScore += 5;
-            break;
-        case 'q':
-            blackScore += 9;
-            break;
-        default:
-            break;
-        }
+        __m128i a = _mm_load_si128((const __m128i *)(acc + i));
+        _mm_store_si128((__m128i *)(acc + i), _mm_sub_epi16(a, _mm_loadu_si128((const __m128i *)(w + i))));
     }
-    std::cout << "White Material: " << whiteScore << "  Black Material: " << blackScore << std::endl;
-    return whiteScore - blackScore;
 }
 
-// material balance (white - black) without debug output
-int materialBalance(const Board &board)
+int32_t nnueOutputSse2(const int16_t *us, const int16_t *them, const int16_t *w)
 {
-    int whiteScore = 0, blackScore = 0;
-    for (char p : board)
+    const __m128i zero = _mm_setzero_si128(), qa = _mm_set1_epi16(NNUE_QA);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_HIDDEN; i += 8)
     {
-        switch (p)
-        {
-        case 'P':
-            whiteScore += 1;
-            break;
-        case 'N':
-        case 'B':
-            whiteScore += 3;
-            break;
-        case 'R':
-            whiteScore += 5;
-            break;
-        case 'Q':
-            whiteScore += 9;
-            break;
-        case 'p':
-            blackScore += 1;
-            break;
-        case 'n':
-        case 'b':
-            blackScore += 3;
-            break;
-        case 'r':
-            blackScore += 5;
-            break;
-        case 'q':
-            blackScore += 9;
-            break;
-        default:
-            break;
-        }
+        __m128i a = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i *)(us + i)), zero), qa);
+        __m128i b = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i *)(them + i)), zero), qa);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, _mm_loadu_si128((const __m128i *)(w + i))));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(b, _mm_loadu_si128((const __m128i *)(w + NNUE_HIDDEN + i))));
     }
-    return whiteScore - blackScore;
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
 }
 
-// Minimal move application (ignores castling/en passant for simplicity)
-GameState applyMove(const GameState &gs, const Move &m)
+TARGET_AVX2 void nnueAddAvx2(int16_t *acc, const int16_t *w)
 {
-    GameState ng = gs;
-    char piece = ng.board[m.from];
-    // reset enPassant unless set below
-    ng.enPassant = -1;
+    for (int i = 0; i < NNUE_HIDDEN; i += 16)
+    {
+        __m256i a = _mm256_load_si256((const __m256i *)(acc + i));
+        _mm256_store_si256((__m256i *)(acc + i), _mm256_add_epi16(a, _mm256_loadu_si256((const __m256i *)(w + i))));
+    }
+}
 
-    // en passant capture
-    if ((piece == 'P' || piece == 'p') && m.isCapture && m.to == gs.enPassant)
+TARGET_AVX2 void nnueSubAvx2(int16_t *acc, const int16_t *w)
+{
+    for (int i = 0; i < NNUE_HIDDEN; i += 16)
     {
-        if (piece == 'P')
-            ng.board[m.to - 8] = '.'; // capture black pawn
-        else
-            ng.board[m.to + 8] = '.'; // capture white pawn
+        __m256i a = _mm256_load_si256((const __m256i *)(acc + i));
+        _mm256_store_si256((__m256i *)(acc + i), _mm256_sub_epi16(a, _mm256_loadu_si256((const __m256i *)(w + i))));
     }
+}
 
-    // move piece / promotion
-    ng.board[m.to] = (m.promotion != '\0') ? m.promotion : piece;
-    ng.board[m.from] = '.';
+TARGET_AVX2 int32_t nnueOutputAvx2(const int16_t *us, const int16_t *them, const int16_t *w)
+{
+    const __m256i zero = _mm256_setzero_si256(), qa = _mm256_set1_epi16(NNUE_QA);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_HIDDEN; i += 16)
+    {
+        __m256i a = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i *)(us + i)), zero), qa);
+        __m256i b = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i *)(them + i)), zero), qa);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, _mm256_loadu_si256((const __m256i *)(w + i))));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(b, _mm256_loadu_si256((const __m256i *)(w + NNUE_HIDDEN + i))));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
 
-    // pawn double move -> set enPassant
-    if (piece == 'P' && m.to - m.from == 16)
-        ng.enPassant = m.from + 8;
-    else if (piece == 'p' && m.from - m.to == 16)
-        ng.enPassant = m.from - 8;
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    return osxsave && (info[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
 
-    // castling: if king moved two squares, move rook
-    if ((piece == 'K' || piece == 'k') && abs((m.to % 8) - (m.from % 8)) == 2)
+// Pick the widest kernels the CPU supports; `forceScalar` is for testing and comparison
+void selectNnueKernels(bool forceScalar)
+{
+    nnueAdd = nnueAddScalar;
+    nnueSub = nnueSubScalar;
+    nnueOutput = nnueOutputScalar;
+    nnueKernelName = "scalar";
+#ifdef NNUE_X86
+    if (forceScalar)
+        return;
+    if (cpuHasAvx2())
     {
-        if (piece == 'K')
-        {
-            if (m.to % 8 == 6)
-            { // white kingside
-                ng.board[5] = 'R';
-                ng.board[7] = '.';
-            }
-            else
-            { // white queenside
-                ng.board[3] = 'R';
-                ng.board[0] = '.';
-            }
-            ng.whiteCastleK = ng.whiteCastleQ = false;
-        }
-        else
-        {
-            if (m.to % 8 == 6)
-            { // black kingside (squares 61/62)
-                ng.board[61] = 'r';
-                ng.board[63] = '.';
-            }
-            else
-            {
-                ng.board[59] = 'r';
-                ng.board[56] = '.';
-            }
-            ng.blackCastleK = ng.blackCastleQ = false;
-        }
+        nnueAdd = nnueAddAvx2;
+        nnueSub = nnueSubAvx2;
+        nnueOutput = nnueOutputAvx2;
+        nnueKernelName = "avx2";
+    }
+    else
+    {
+        nnueAdd = nnueAddSse2;
+        nnueSub = nnueSubSse2;
+        nnueOutput = nnueOutputSse2;
+        nnueKernelName = "sse2";
     }
+#else
+    (void)forceScalar;
+#endif
+}
 
-    // update castling rights if king or rook moved/captured
-    if (m.from == 4 || m.to == 4)
+bool loadNetwork(const std::string &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+    {
+        std::cout << "Cannot open network file " << path << "\n";
+        return false;
+    }
+    char magic[4];
+    uint32_t version = 0, hidden = 0;
+    f.read(magic, 4);
+    f.read((char *)&version, sizeof(version));
+    f.read((char *)&hidden, sizeof(hidden));
+    if (!f || std::memcmp(magic, "CNUE", 4) != 0 || version != 1 || hidden != (uint32_t)NNUE_HIDDEN)
     {
-        ng.whiteCastleK = ng.whiteCastleQ = false;
+        std::cout << "Unsupported network file " << path << " (expected CNUE version 1, " << NNUE_HIDDEN << " hidden)\n";
+        return false;
     }
-    if (m.from == 60 || m.to == 60)
+    network.featureWeights.resize((size_t)NNUE_FEATURES * NNUE_HIDDEN);
+    f.read((char *)network.featureWeights.data(), network.featureWeights.size() * sizeof(int16_t));
+    f.read((char *)network.featureBias, sizeof(network.featureBias));
+    f.read((char *)network.outputWeights, sizeof(network.outputWeights));
+    f.read((char *)&network.outputBias, sizeof(network.outputBias));
+    if (!f)
     {
-        ng.blackCastleK = ng.blackCastleQ = false;
+        std::cout << "Truncated network file " << path << "\n";
+        return false;
     }
-    if (m.from == 0 || m.to == 0)
-        ng.whiteCastleQ = false;
-    if (m.from == 7 || m.to == 7)
-        ng.whiteCastleK = false;
-    if (m.from == 56 || m.to == 56)
-        ng.blackCastleQ = false;
-    if (m.from == 63 || m.to == 63)
-        ng.blackCastleK = false;
+    nnueEnabled = true;
+    return true;
+}
 
-    return ng;
+// feature of a piece as seen from `perspective`: black sees the board flipped with colors swapped
+inline int nnueFeature(int perspective, int color, int type, int sq)
+{
+    return perspective == WHITE ? (color * 6 + type) * 64 + sq
+                                : ((color ^ 1) * 6 + type) * 64 + (sq ^ 56);
 }
 
-// --- Pawn + piece move generators (simplified) ---
-int fileOf(int idx) { return idx % 8; }
-int rankOf(int idx) { return idx / 8; }
-bool sameColor(char a, char b)
+inline void nnueAddPiece(GameState &gs, int color, int type, int sq)
 {
-    if (a == '.' || b == '.')
-        return false;
-    return (isWhite(a) && isWhite(b)) || (isBlack(a) && isBlack(b));
+    for (int p = 0; p < 2; ++p)
+        nnueAdd(gs.accumulator->v[p], &network.featureWeights[(size_t)nnueFeature(p, color, type, sq) * NNUE_HIDDEN]);
 }
 
-void generatePawnMoves(const GameState &gs, bool whiteTurn, std::vector<Move> &moves)
+inline void nnueRemovePiece(GameState &gs, int color, int type, int sq)
 {
-    const Board &board = gs.board;
-    for (int i = 0; i < 64; ++i)
+    for (int p = 0; p < 2; ++p)
+        nnueSub(gs.accumulator->v[p], &network.featureWeights[(size_t)nnueFeature(p, color, type, sq) * NNUE_HIDDEN]);
+}
+
+// side-to-move perspective, centipawns
+int nnueEvaluate(const GameState &gs, bool whiteTurn)
+{
+    int us = whiteTurn ? WHITE : BLACK;
+    int64_t out = (int64_t)nnueOutput(gs.accumulator->v[us], gs.accumulator->v[us ^ 1], network.outputWeights) + network.outputBias;
+    return (int)(out * NNUE_SCALE / (NNUE_QA * NNUE_QB));
+}
+
+// --- Piece placement: every board change goes through these so bitboards, key and evaluation stay in sync ---
+void putPiece(GameState &gs, int sq, char p)
+{
+    int color = isWhite(p) ? WHITE : BLACK;
+    int type = pieceTypeOf(p);
+    gs.board[sq] = p;
+    gs.pieces[color][type] |= squareBB(sq);
+    gs.occupancy[color] |= squareBB(sq);
+    gs.key ^= zobristPiece[color][type][sq];
+    gs.material[color] += pieceMaterial[type];
+    gs.psqMg += psqMg[color][type][sq];
+    gs.psqEg += psqEg[color][type][sq];
+    gs.phase += phaseWeight[type];
+    if (gs.accumulator)
+        nnueAddPiece(gs, color, type, sq);
+}
+
+void removePiece(GameState &gs, int sq)
+{
+    char p = gs.board[sq];
+    if (p == '.')
+        return;
+    int color = isWhite(p) ? WHITE : BLACK;
+    int type = pieceTypeOf(p);
+    gs.board[sq] = '.';
+    gs.pieces[color][type] &= ~squareBB(sq);
+    gs.occupancy[color] &= ~squareBB(sq);
+    gs.key ^= zobristPiece[color][type][sq];
+    gs.material[color] -= pieceMaterial[type];
+    gs.psqMg -= psqMg[color][type][sq];
+    gs.psqEg -= psqEg[color][type][sq];
+    gs.phase -= phaseWeight[type];
+    if (gs.accumulator)
+        nnueRemovePiece(gs, color, type, sq);
+}
+
+// Full Zobrist key from scratch (board + castling rights + en passant + side to move)
+uint64_t computeKey(const GameState &gs, bool whiteTurn)
+{
+    uint64_t k = 0;
+    for (int sq = 0; sq < 64; ++sq)
+        if (gs.board[sq] != '.')
+            k ^= zobristPiece[isWhite(gs.board[sq]) ? WHITE : BLACK][pieceTypeOf(gs.board[sq])][sq];
+    k ^= zobristCastling[castlingBits(gs)];
+    if (gs.enPassant >= 0)
+        k ^= zobristEnPassant[gs.enPassant % 8];
+    if (!whiteTurn)
+        k ^= zobristSide;
+    return k;
+}
+
+// Rebuild bitboards, key and evaluation terms from the `board` array (after setting up a position by hand)
+void syncBitboards(GameState &gs, bool whiteTurn)
+{
+    for (int c = 0; c < 2; ++c)
     {
-        if (whiteTurn && board[i] == 'P')
-        {
-            // Forward 1
-            if (i + 8 < 64 && board[i + 8] == '.')
-            {
-                // promotion
-                if (i + 8 >= 56)
-                {
-                    addMove(moves, i, i + 8, false, 'Q');
-                    addMove(moves, i, i + 8, false, 'R');
-                    addMove(moves, i, i + 8, false, 'B');
-                    addMove(moves, i, i + 8, false, 'N');
-                }
-                else
-                    addMove(moves, i, i + 8);
-                // Forward 2
-                if (i / 8 == 1 && board[i + 16] == '.')
-                    addMove(moves, i, i + 16);
-            }
-            // Captures
-            if (i % 8 != 0)
-            {
-                if (i + 7 < 64 && isBlack(board[i + 7]))
-                {
-                    if (i + 7 >= 56)
-                    {
-                        addMove(moves, i, i + 7, true, 'Q');
-                        addMove(moves, i, i + 7, true, 'R');
-                        addMove(moves, i, i + 7, true, 'B');
-                        addMove(moves, i, i + 7, true, 'N');
+        gs.occupancy[c] = 0;
+        gs.material[c] = 0;
+        for (int t = 0; t < 6; ++t)
+            gs.pieces[c][t] = 0;
+    }
+    gs.psqMg = gs.psqEg = gs.phase = 0;
+    if (gs.accumulator)
+        for (int p = 0; p < 2; ++p)
+            std::copy(network.featureBias, network.featureBias + NNUE_HIDDEN, gs.accumulator->v[p]);
+    for (int sq = 0; sq < 64; ++sq)
+        if (gs.board[sq] != '.')
+            putPiece(gs, sq, gs.board[sq]);
+    gs.key = computeKey(gs, whiteTurn);
+}
+
+inline Bitboard occupied(const GameState &gs) { return gs.occupancy[WHITE] | gs.occupancy[BLACK]; }
+
+void addMove(MoveList &moves, int from, int to, int flags = FLAG_QUIET)
+{
+    moves.push(Move(from, to, flags));
+}
+
+// board character of the piece a promotion move creates
+char promotionPiece(const Move &m, bool white)
+{
+    const char *pieces = white ? ".NBRQ" : ".nbrq";
+    return pieces[m.promotionType()];
+}
+
+std::string squareName(int i)
+{
+    char file = 'a' + (i % 8);
+    char rank = '1' + (i / 8);
+    return std::string() + file + rank;
+}
+
+// coordinate notation, e.g. "e2e4" or "e7e8q"
+std::string moveString(const Move &m)
+{
+    std::string s = squareName(m.from()) + squareName(m.to());
+    if (m.isPromotion())
+        s.push_back(promotionPiece(m, false));
+    return s;
+}
+
+void printBoard(const Board &board)
+{
+    for (int rank = 7; rank >= 0; --rank)
+    {
+        for (int file = 0; file < 8; ++file)
+        {
+            std::cout << board[rank * 8 + file] << ' ';
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Write a simple JSON file representing the board for the web UI
+void writeBoardJson(const GameState &gs, const std::string &path = "web/board.json")
+{
+    std::ofstream f(path);
+    if (!f)
+        return;
+    f << "{\"board\": [";
+    for (int i = 0; i < 64; ++i)
+    {
+        char c = gs.board[i];
+        if (c == '"')
+            c = '\\"';
+        f << '\"' << c << '\"';
+        if (i < 63)
+            f << ',';
+    }
+    f << "], \"enPassant\": " << gs.enPassant << " }";
+    f.close();
+}
+
+// Game records of the recent games played by this process, kept for the spectator server
+// (--serve); a publish wakes all connections waiting for new records. Game ids count from the
+// first game of the process: games[0] is game `firstId`. Once more than FEED_HUB_GAMES are
+// kept, the oldest finished ones are dropped, so a long --match does not grow without bound.
+const size_t FEED_HUB_GAMES = 256;
+
+struct FeedHub
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<std::string>> games;
+    int firstId = 0;
+    bool enabled = false;
+
+    // records of game `id`, null once dropped (call with the mutex held)
+    const std::vector<std::string> *game(int id) const
+    {
+        return id >= firstId && id - firstId < (int)games.size() ? &games[id - firstId] : nullptr;
+    }
+};
+
+FeedHub feedHub;
+
+int hubNewGame(const std::string &record)
+{
+    std::lock_guard<std::mutex> lock(feedHub.mutex);
+    feedHub.games.push_back({record});
+    while (feedHub.games.size() > FEED_HUB_GAMES && feedHub.games.front().back()[0] == 'R')
+    {
+        feedHub.games.pop_front();
+        ++feedHub.firstId;
+    }
+    feedHub.changed.notify_all();
+    return feedHub.firstId + (int)feedHub.games.size() - 1;
+}
+
+void hubPublish(int game, const std::string &record)
+{
+    std::lock_guard<std::mutex> lock(feedHub.mutex);
+    feedHub.games[game - feedHub.firstId].push_back(record);
+    feedHub.changed.notify_all();
+}
+
+// Append-only game feed for the web UI (web/game.feed), one text line per record:
+//   "G <64 board chars> <w|b>"           a new game starts from this position
+//   "M <ply> <move> <square><piece>..."  the move reaching position <ply> and the squares it changed
+//   "R <result>"                         the game is over
+// A new game replaces the file by renaming a complete one over it; each move is a single append
+// flushed at once, so a reader that only consumes whole lines never sees a torn record.
+// The same records go to the spectator server when it runs; an empty path writes no file.
+struct GameFeed
+{
+    std::FILE *file = nullptr;
+    int hubGame = -1;
+    Board board{};
+    int ply = 0;
+};
+
+void writeFeedRecord(GameFeed &feed, const std::string &rec)
+{
+    if (feed.file)
+    {
+        std::string line = rec + '\n';
+        std::fwrite(line.data(), 1, line.size(), feed.file);
+        std::fflush(feed.file);
+    }
+    if (feed.hubGame >= 0)
+        hubPublish(feed.hubGame, rec);
+}
+
+bool startGameFeed(GameFeed &feed, const GameState &gs, bool whiteTurn, const std::string &path = "web/game.feed")
+{
+    if (feed.file)
+        std::fclose(feed.file);
+    feed.file = nullptr;
+    feed.board = gs.board;
+    feed.ply = 0;
+    std::string header = "G " + std::string(gs.board.begin(), gs.board.end()) + ' ' + (whiteTurn ? 'w' : 'b');
+    feed.hubGame = feedHub.enabled ? hubNewGame(header) : -1;
+    if (path.empty())
+        return true;
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary);
+        if (!f)
+            return false;
+        f << header << '\n';
+        if (!f.flush())
+            return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        return false;
+    feed.file = std::fopen(path.c_str(), "ab");
+    return feed.file != nullptr;
+}
+
+// Record `m`, after which the position is `gs`
+void appendGameFeed(GameFeed &feed, const GameState &gs, Move m)
+{
+    if (!feed.file && feed.hubGame < 0)
+        return;
+    std::string rec = "M " + std::to_string(++feed.ply) + ' ' + moveString(m);
+    for (int sq = 0; sq < 64; ++sq)
+        if (gs.board[sq] != feed.board[sq])
+        {
+            rec += ' ';
+            rec += squareName(sq);
+            rec += gs.board[sq];
+        }
+    feed.board = gs.board;
+    writeFeedRecord(feed, rec);
+}
+
+void closeGameFeed(GameFeed &feed, const std::string &result)
+{
+    writeFeedRecord(feed, "R " + result);
+    if (feed.file)
+        std::fclose(feed.file);
+    feed.file = nullptr;
+    feed.hubGame = -1;
+}
+
+// Bitboard of all pieces of both colors attacking `sq`, given occupancy `occ`
+Bitboard attackersTo(const GameState &gs, int sq, Bitboard occ)
+{
+    return (pawnAttacks[BLACK][sq] & gs.pieces[WHITE][PAWN]) |
+           (pawnAttacks[WHITE][sq] & gs.pieces[BLACK][PAWN]) |
+           (knightAttacks[sq] & (gs.pieces[WHITE][KNIGHT] | gs.pieces[BLACK][KNIGHT])) |
+           (bishopAttacks(sq, occ) & (gs.pieces[WHITE][BISHOP] | gs.pieces[BLACK][BISHOP] | gs.pieces[WHITE][QUEEN] | gs.pieces[BLACK][QUEEN])) |
+           (rookAttacks(sq, occ) & (gs.pieces[WHITE][ROOK] | gs.pieces[BLACK][ROOK] | gs.pieces[WHITE][QUEEN] | gs.pieces[BLACK][QUEEN])) |
+           (kingAttacks[sq] & (gs.pieces[WHITE][KING] | gs.pieces[BLACK][KING]));
+}
+
+// Is square attacked by side 'byWhite'
+bool isSquareAttacked(const GameState &gs, int sq, bool byWhite)
+{
+    const int them = byWhite ? WHITE : BLACK;
+    const Bitboard *p = gs.pieces[them];
+    // a pawn of ours standing on sq would attack exactly the squares enemy pawns attack sq from
+    if (pawnAttacks[them ^ 1][sq] & p[PAWN])
+        return true;
+    if (knightAttacks[sq] & p[KNIGHT])
+        return true;
+    if (kingAttacks[sq] & p[KING])
+        return true;
+    Bitboard occ = occupied(gs);
+    if (bishopAttacks(sq, occ) & (p[BISHOP] | p[QUEEN]))
+        return true;
+    if (rookAttacks(sq, occ) & (p[ROOK] | p[QUEEN]))
+        return true;
+    return false;
+}
+
+int findKingSquare(const GameState &gs, bool white)
+{
+    Bitboard k = gs.pieces[white ? WHITE : BLACK][KING];
+    return k ? lsb(k) : -1;
+}
+
+// Evaluation: tapered piece-square score (white - black), blended by game phase
+int evaluate(const GameState &gs)
+{
+    int phase = std::min(gs.phase, PHASE_MAX);
+    return (gs.psqMg * phase + gs.psqEg * (PHASE_MAX - phase)) / PHASE_MAX;
+}
+
+// material balance (white - black) in pieceMaterial points
+int materialBalance(const GameState &gs)
+{
+    return gs.material[WHITE] - gs.material[BLACK];
+}
+
+// Everything makeMove destroys that cannot be recomputed from the move itself.
+struct Undo
+{
+    char captured;     // piece removed by the move, '.' if none (the pawn for en passant)
+    uint8_t castling;  // castling rights before the move, bit 0..3 = K Q k q
+    int8_t enPassant;  // en passant square before the move
+    int halfmoveClock; // halfmove clock before the move
+    uint64_t key;      // Zobrist key before the move
+};
+
+// rook squares (from, to) for a castling king move landing on `kingTo`
+void castlingRookSquares(int kingTo, int &rookFrom, int &rookTo)
+{
+    bool kingside = kingTo % 8 == 6;
+    int base = kingTo - kingTo % 8;
+    rookFrom = base + (kingside ? 7 : 0);
+    rookTo = base + (kingside ? 5 : 3);
+}
+
+// Play `m` on `gs` in place, saving what is needed to take it back into `u`
+void makeMove(GameState &gs, const Move &m, Undo &u)
+{
+    char piece = gs.board[m.from()];
+    bool isPawn = piece == 'P' || piece == 'p';
+    u.castling = castlingBits(gs);
+    u.enPassant = (int8_t)gs.enPassant;
+    u.halfmoveClock = gs.halfmoveClock;
+    u.key = gs.key;
+    u.captured = '.';
+    // the child's accumulators start as a copy of the parent's, one slot up the stack
+    if (gs.accumulator)
+    {
+        gs.accumulator[1] = gs.accumulator[0];
+        ++gs.accumulator;
+    }
+
+    // castling/en passant/side terms are removed here and re-added for the new state below
+    gs.key ^= zobristCastling[u.castling] ^ zobristSide;
+    if (gs.enPassant >= 0)
+        gs.key ^= zobristEnPassant[gs.enPassant % 8];
+
+    // en passant capture
+    if (m.isEnPassant())
+    {
+        int capSq = piece == 'P' ? m.to() - 8 : m.to() + 8;
+        u.captured = gs.board[capSq];
+        removePiece(gs, capSq);
+    }
+    else if (gs.board[m.to()] != '.')
+    {
+        u.captured = gs.board[m.to()];
+        removePiece(gs, m.to());
+    }
+
+    // move piece / promotion
+    removePiece(gs, m.from());
+    putPiece(gs, m.to(), m.isPromotion() ? promotionPiece(m, isWhite(piece)) : piece);
+
+    // pawn double move -> set enPassant
+    gs.enPassant = -1;
+    if (m.flags() == FLAG_DOUBLE_PUSH)
+        gs.enPassant = (m.from() + m.to()) / 2;
+
+    // castling: king moved two squares, move rook
+    if (m.isCastle())
+    {
+        int rookFrom, rookTo;
+        castlingRookSquares(m.to(), rookFrom, rookTo);
+        removePiece(gs, rookFrom);
+        putPiece(gs, rookTo, piece == 'K' ? 'R' : 'r');
+    }
+
+    // update castling rights if king or rook moved/captured
+    if (m.from() == 4 || m.to() == 4)
+        gs.whiteCastleK = gs.whiteCastleQ = false;
+    if (m.from() == 60 || m.to() == 60)
+        gs.blackCastleK = gs.blackCastleQ = false;
+    if (m.from() == 0 || m.to() == 0)
+        gs.whiteCastleQ = false;
+    if (m.from() == 7 || m.to() == 7)
+        gs.whiteCastleK = false;
+    if (m.from() == 56 || m.to() == 56)
+        gs.blackCastleQ = false;
+    if (m.from() == 63 || m.to() == 63)
+        gs.blackCastleK = false;
+
+    gs.key ^= zobristCastling[castlingBits(gs)];
+    if (gs.enPassant >= 0)
+        gs.key ^= zobristEnPassant[gs.enPassant % 8];
+
+    // clocks: reset on pawn move or capture, full move counter advances after black
+    if (isPawn || u.captured != '.')
+        gs.halfmoveClock = 0;
+    else
+        ++gs.halfmoveClock;
+    if (isBlack(piece))
+        ++gs.fullmoveNumber;
+}
+
+// Take back `m`, which must be the last move made on `gs` with undo record `u`
+void unmakeMove(GameState &gs, const Move &m, const Undo &u)
+{
+    char piece = gs.board[m.to()];
+    if (m.isPromotion())
+        piece = isWhite(piece) ? 'P' : 'p';
+    // the parent's accumulators are still intact one slot down, so the pieces move back without them
+    NnueAccumulator *accumulator = gs.accumulator ? gs.accumulator - 1 : nullptr;
+    gs.accumulator = nullptr;
+
+    // castling: put the rook back first (king is still on m.to())
+    if (m.isCastle())
+    {
+        int rookFrom, rookTo;
+        castlingRookSquares(m.to(), rookFrom, rookTo);
+        removePiece(gs, rookTo);
+        putPiece(gs, rookFrom, piece == 'K' ? 'R' : 'r');
+    }
+
+    removePiece(gs, m.to());
+    putPiece(gs, m.from(), piece);
+    if (u.captured != '.')
+    {
+        int capSq = m.isEnPassant() ? (piece == 'P' ? m.to() - 8 : m.to() + 8) : m.to();
+        putPiece(gs, capSq, u.captured);
+    }
+
+    setCastlingBits(gs, u.castling);
+    gs.enPassant = u.enPassant;
+    gs.halfmoveClock = u.halfmoveClock;
+    gs.key = u.key;
+    if (isBlack(piece))
+        --gs.fullmoveNumber;
+    gs.accumulator = accumulator;
+}
+
+// Pass the turn (null move pruning): only the key, en passant square and clock change
+void makeNullMove(GameState &gs, Undo &u)
+{
+    u.captured = '.';
+    u.castling = castlingBits(gs);
+    u.enPassant = (int8_t)gs.enPassant;
+    u.halfmoveClock = gs.halfmoveClock;
+    u.key = gs.key;
+    if (gs.enPassant >= 0)
+        gs.key ^= zobristEnPassant[gs.enPassant % 8];
+    gs.enPassant = -1;
+    gs.key ^= zobristSide;
+    ++gs.halfmoveClock;
+}
+
+void unmakeNullMove(GameState &gs, const Undo &u)
+{
+    gs.enPassant = u.enPassant;
+    gs.halfmoveClock = u.halfmoveClock;
+    gs.key = u.key;
+}
+
+// --- Pawn + piece move generators (bitboard based) ---
+int fileOf(int idx) { return idx % 8; }
+int rankOf(int idx) { return idx / 8; }
+
+// push one move per target square in `targets`; captures are flagged from the enemy occupancy
+void addMoves(MoveList &moves, int from, Bitboard targets, Bitboard enemies)
+{
+    while (targets)
+    {
+        int to = popLsb(targets);
+        addMove(moves, from, to, (enemies & squareBB(to)) ? FLAG_CAPTURE : FLAG_QUIET);
+    }
+}
+
+// queen first, then rook, bishop, knight
+void addPromotions(MoveList &moves, int from, int to, bool isCapture)
+{
+    int base = isCapture ? FLAG_PROMOTION_CAPTURE : FLAG_PROMOTION;
+    for (int type = QUEEN; type >= KNIGHT; --type)
+        addMove(moves, from, to, base + type - KNIGHT);
+}
+
+enum GenType
+{
+    GEN_ALL,
+    GEN_CAPTURES, // captures, en passant and capturing promotions
+    GEN_TACTICAL  // captures plus quiet promotions, for the quiescence search
+};
+
+// Legal move generator. Checkers and pinned pieces are computed once, so every move it
+// emits is legal without making it: in double check only the king moves, in single check
+// the other pieces must capture the checker or block, pinned pieces stay on their pin line,
+// and king moves and en passant are tested against the occupancy after the move.
+// With `out` == nullptr nothing is stored and only the number of moves is returned.
+int generateLegal(const GameState &gs, bool whiteTurn, MoveList *out, GenType type)
+{
+    const int us = whiteTurn ? WHITE : BLACK;
+    const int them = us ^ 1;
+    if (!gs.pieces[us][KING])
+        return 0;
+    const int ksq = lsb(gs.pieces[us][KING]);
+    const Bitboard occ = occupied(gs);
+    const Bitboard own = gs.occupancy[us];
+    const Bitboard enemies = gs.occupancy[them];
+    const Bitboard checkers = attackersTo(gs, ksq, occ) & enemies;
+    int count = 0;
+
+    // king moves: the destination must not be attacked once the king has left ksq
+    Bitboard kingTargets = kingAttacks[ksq] & ~own;
+    if (type != GEN_ALL)
+        kingTargets &= enemies;
+    while (kingTargets)
+    {
+        int to = popLsb(kingTargets);
+        if (attackersTo(gs, to, occ ^ squareBB(ksq)) & enemies)
+            continue;
+        if (out)
+            addMove(*out, ksq, to, (enemies & squareBB(to)) ? FLAG_CAPTURE : FLAG_QUIET);
+        ++count;
+    }
+    // castling: squares between king and rook empty, king not in check and not crossing an attacked square
+    if (type == GEN_ALL && !checkers)
+    {
+        const Board &board = gs.board;
+        bool white = us == WHITE;
+        int home = white ? 4 : 60;
+        bool canK = white ? gs.whiteCastleK : gs.blackCastleK;
+        bool canQ = white ? gs.whiteCastleQ : gs.blackCastleQ;
+        if (ksq == home && canK && board[home + 1] == '.' && board[home + 2] == '.' &&
+            !isSquareAttacked(gs, home + 1, !white) && !isSquareAttacked(gs, home + 2, !white))
+        {
+            if (out)
+                addMove(*out, home, home + 2, FLAG_KING_CASTLE);
+            ++count;
+        }
+        if (ksq == home && canQ && board[home - 1] == '.' && board[home - 2] == '.' && board[home - 3] == '.' &&
+            !isSquareAttacked(gs, home - 1, !white) && !isSquareAttacked(gs, home - 2, !white))
+        {
+            if (out)
+                addMove(*out, home, home - 2, FLAG_QUEEN_CASTLE);
+            ++count;
+        }
+    }
+    if (popCount(checkers) > 1)
+        return count;
+
+    // squares the other pieces may move to: anything but our own pieces, or only the
+    // checker and the squares between it and the king
+    Bitboard targetMask = ~own;
+    if (checkers)
+        targetMask &= checkers | betweenBB[ksq][lsb(checkers)];
+    const Bitboard pieceTargets = type == GEN_ALL ? targetMask : targetMask & enemies;
+
+    // our pieces standing alone between the king and an enemy slider
+    Bitboard pinned = 0;
+    Bitboard snipers = (rookAttacks(ksq, 0) & (gs.pieces[them][ROOK] | gs.pieces[them][QUEEN])) |
+                       (bishopAttacks(ksq, 0) & (gs.pieces[them][BISHOP] | gs.pieces[them][QUEEN]));
+    while (snipers)
+    {
+        Bitboard blockers = betweenBB[ksq][popLsb(snipers)] & occ;
+        if (popCount(blockers) == 1)
+            pinned |= blockers & own;
+    }
+
+    for (int t = KNIGHT; t <= QUEEN; ++t)
+    {
+        Bitboard b = gs.pieces[us][t];
+        if (t == KNIGHT)
+            b &= ~pinned; // a pinned knight can never move
+        while (b)
+        {
+            int from = popLsb(b);
+            Bitboard attacks = t == KNIGHT   ? knightAttacks[from]
+                               : t == BISHOP ? bishopAttacks(from, occ)
+                               : t == ROOK   ? rookAttacks(from, occ)
+                                             : queenAttacks(from, occ);
+            attacks &= pieceTargets;
+            if (pinned & squareBB(from))
+                attacks &= lineBB[ksq][from];
+            if (out)
+                addMoves(*out, from, attacks, enemies);
+            count += popCount(attacks);
+        }
+    }
+
+    const int push = us == WHITE ? 8 : -8;
+    const Bitboard promoRank = us == WHITE ? Rank8BB : Rank1BB;
+    const Bitboard doublePushRank = us == WHITE ? Rank1BB << 24 : Rank1BB << 32;
+    Bitboard pawns = gs.pieces[us][PAWN];
+    while (pawns)
+    {
+        int from = popLsb(pawns);
+        const Bitboard allowed = (pinned & squareBB(from)) ? targetMask & lineBB[ksq][from] : targetMask;
+        // pushes
+        int to = from + push;
+        if (!(occ & squareBB(to)))
+        {
+            if (promoRank & squareBB(to))
+            {
+                if (type != GEN_CAPTURES && (allowed & squareBB(to)))
+                {
+                    if (out)
+                        addPromotions(*out, from, to, false);
+                    count += 4;
+                }
+            }
+            else if (type == GEN_ALL)
+            {
+                if (allowed & squareBB(to))
+                {
+                    if (out)
+                        addMove(*out, from, to);
+                    ++count;
+                }
+                int to2 = to + push;
+                if ((doublePushRank & squareBB(to2)) && !(occ & squareBB(to2)) && (allowed & squareBB(to2)))
+                {
+                    if (out)
+                        addMove(*out, from, to2, FLAG_DOUBLE_PUSH);
+                    ++count;
+                }
+            }
+        }
+        // captures
+        Bitboard caps = pawnAttacks[us][from] & enemies & allowed;
+        while (caps)
+        {
+            to = popLsb(caps);
+            if (promoRank & squareBB(to))
+            {
+                if (out)
+                    addPromotions(*out, from, to, true);
+                count += 4;
+            }
+            else
+            {
+                if (out)
+                    addMove(*out, from, to, FLAG_CAPTURE);
+                ++count;
+            }
+        }
+        // en passant: two pawns leave the rank at once, so test the resulting occupancy directly
+        if (gs.enPassant >= 0 && (pawnAttacks[us][from] & squareBB(gs.enPassant)))
+        {
+            int capSq = gs.enPassant - push;
+            Bitboard after = (occ ^ squareBB(from) ^ squareBB(capSq)) | squareBB(gs.enPassant);
+            if (!(attackersTo(gs, ksq, after) & enemies & ~squareBB(capSq)))
+            {
+                if (out)
+                    addMove(*out, from, gs.enPassant, FLAG_EN_PASSANT);
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+void generateLegalMoves(const GameState &gs, bool whiteTurn, MoveList &legal)
+{
+    generateLegal(gs, whiteTurn, &legal, GEN_ALL);
+}
+
+int countLegalMoves(const GameState &gs, bool whiteTurn)
+{
+    return generateLegal(gs, whiteTurn, nullptr, GEN_ALL);
+}
+
+// Standard algebraic notation for legal move `m`, with disambiguation and check/mate markers
+std::string moveToSan(GameState &gs, const Move &m, bool whiteTurn)
+{
+    char piece = gs.board[m.from()];
+    std::string san;
+    // castling
+    if ((piece == 'K' || piece == 'k') && abs((m.to() % 8) - (m.from() % 8)) == 2)
+        san = (m.to() % 8) == 6 ? "O-O" : "O-O-O";
+    else if (piece == 'P' || piece == 'p')
+    {
+        if (m.isCapture())
+        {
+            san.push_back('a' + (m.from() % 8));
+            san.push_back('x');
+        }
+        san += squareName(m.to());
+        if (m.isPromotion())
+        {
+            san.push_back('=');
+            san.push_back(promotionPiece(m, true));
+        }
+    }
+    else
+    {
+        san.push_back((char)toupper((unsigned char)piece));
+        // disambiguate against other pieces of the same kind that can reach m.to()
+        MoveList legal;
+        generateLegalMoves(gs, whiteTurn, legal);
+        bool ambiguous = false, sameFile = false, sameRank = false;
+        for (auto &o : legal)
+        {
+            if (o.to() != m.to() || o.from() == m.from() || gs.board[o.from()] != piece)
+                continue;
+            ambiguous = true;
+            sameFile |= o.from() % 8 == m.from() % 8;
+            sameRank |= o.from() / 8 == m.from() / 8;
+        }
+        if (ambiguous)
+        {
+            if (!sameFile)
+                san.push_back('a' + (m.from() % 8));
+            else if (!sameRank)
+                san.push_back('1' + (m.from() / 8));
+            else
+                san += squareName(m.from());
+        }
+        if (m.isCapture())
+            san.push_back('x');
+        san += squareName(m.to());
+    }
+
+    // check/mate detection
+    Undo u;
+    makeMove(gs, m, u);
+    int oppKing = findKingSquare(gs, !whiteTurn);
+    bool inCheck = (oppKing != -1) && isSquareAttacked(gs, oppKing, whiteTurn);
+    if (inCheck)
+        san += countLegalMoves(gs, !whiteTurn) == 0 ? '#' : '+';
+    unmakeMove(gs, m, u);
+    return san;
+}
+
+// Find the legal move written as `san`. Tolerates missing/extra check marks, "0-0" castling,
+// promotions without '=', lowercase promotion letters and redundant disambiguation.
+bool parseSan(const GameState &gs, bool whiteTurn, const char *san, size_t len, Move &out)
+{
+    while (len && std::strchr("+#!?", san[len - 1]))
+        --len;
+    MoveList legal;
+    generateLegalMoves(gs, whiteTurn, legal);
+
+    std::string_view text(san, len);
+    if (text == "O-O" || text == "0-0" || text == "O-O-O" || text == "0-0-0")
+    {
+        int file = len == 3 ? 6 : 2;
+        for (auto &m : legal)
+        {
+            char p = gs.board[m.from()];
+            if ((p == 'K' || p == 'k') && abs(m.to() % 8 - m.from() % 8) == 2 && m.to() % 8 == file)
+            {
+                out = m;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int pieceType = PAWN;
+    size_t pos = 0;
+    if (len && std::strchr("NBRQK", san[0]))
+        pieceType = pieceTypeOf(san[pos++]);
+    int promo = NO_PIECE_TYPE;
+    size_t eq = text.find('=');
+    if (eq != std::string_view::npos && eq + 1 < len)
+    {
+        promo = pieceTypeOf(san[eq + 1]);
+        len = eq;
+    }
+    else if (pieceType == PAWN && len > 2 && std::strchr("NBRQnbrq", san[len - 1]))
+        promo = pieceTypeOf(san[--len]);
+    // origin hints and target square, without capture marks
+    char rest[16];
+    size_t restLen = 0;
+    for (size_t i = pos; i < len; ++i)
+        if (san[i] != 'x' && san[i] != '-' && san[i] != ':')
+        {
+            if (restLen == sizeof(rest))
+                return false;
+            rest[restLen++] = san[i];
+        }
+    if (restLen < 2)
+        return false;
+    int toFile = rest[restLen - 2] - 'a', toRank = rest[restLen - 1] - '1';
+    if (toFile < 0 || toFile > 7 || toRank < 0 || toRank > 7)
+        return false;
+    int to = toRank * 8 + toFile;
+    int fromFile = -1, fromRank = -1;
+    for (size_t i = 0; i + 2 < restLen; ++i)
+    {
+        if (rest[i] >= 'a' && rest[i] <= 'h')
+            fromFile = rest[i] - 'a';
+        else if (rest[i] >= '1' && rest[i] <= '8')
+            fromRank = rest[i] - '1';
+    }
+
+    int found = 0;
+    for (auto &m : legal)
+    {
+        if (m.to() != to || pieceTypeOf(gs.board[m.from()]) != pieceType)
+            continue;
+        if ((m.isPromotion() ? m.promotionType() : NO_PIECE_TYPE) != promo)
+            continue;
+        if ((fromFile >= 0 && m.from() % 8 != fromFile) || (fromRank >= 0 && m.from() / 8 != fromRank))
+            continue;
+        out = m;
+        ++found;
+    }
+    return found == 1;
+}
+
+bool parseSan(const GameState &gs, bool whiteTurn, const std::string &san, Move &out)
+{
+    return parseSan(gs, whiteTurn, san.data(), san.size(), out);
+}
+
+// Static exchange evaluation: material gain (in pieceMaterial units, mover's perspective) of
+// move `m` followed by the best sequence of captures and recaptures on m.to(), each side
+// always recapturing with its least valuable attacker and free to stop. X-ray attackers
+// behind sliders are picked up as the square clears; pins are ignored.
+int see(const GameState &gs, const Move &m)
+{
+    if (m.isCastle())
+        return 0;
+    const int from = m.from(), to = m.to();
+    const int us = isWhite(gs.board[from]) ? WHITE : BLACK;
+    int gain[32];
+    int d = 0;
+    int onSquare = pieceTypeOf(gs.board[from]); // piece that will be captured next
+    gain[0] = m.isEnPassant() ? pieceMaterial[PAWN] : m.isCapture() ? pieceMaterial[pieceTypeOf(gs.board[to])] : 0;
+    if (m.isPromotion())
+    {
+        onSquare = m.promotionType();
+        gain[0] += pieceMaterial[onSquare] - pieceMaterial[PAWN];
+    }
+
+    Bitboard occ = occupied(gs) ^ squareBB(from);
+    if (m.isEnPassant())
+        occ ^= squareBB(us == WHITE ? to - 8 : to + 8);
+    const Bitboard diagonal = gs.pieces[WHITE][BISHOP] | gs.pieces[BLACK][BISHOP] | gs.pieces[WHITE][QUEEN] | gs.pieces[BLACK][QUEEN];
+    const Bitboard straight = gs.pieces[WHITE][ROOK] | gs.pieces[BLACK][ROOK] | gs.pieces[WHITE][QUEEN] | gs.pieces[BLACK][QUEEN];
+    Bitboard attackers = attackersTo(gs, to, occ) & occ;
+    int side = us ^ 1;
+    while (d < 31)
+    {
+        Bitboard mine = attackers & gs.occupancy[side];
+        if (!mine)
+            break;
+        int type = PAWN;
+        while (!(mine & gs.pieces[side][type]))
+            ++type;
+        // the king may only recapture when nothing defends the square any more
+        if (type == KING && (attackers & gs.occupancy[side ^ 1]))
+            break;
+        ++d;
+        gain[d] = pieceMaterial[onSquare] - gain[d - 1];
+        occ ^= squareBB(lsb(mine & gs.pieces[side][type]));
+        attackers |= (bishopAttacks(to, occ) & diagonal) | (rookAttacks(to, occ) & straight);
+        attackers &= occ;
+        onSquare = type;
+        side ^= 1;
+    }
+    // negamax the swap list back: each side only continues the exchange if it pays
+    while (d > 0)
+    {
+        gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+        --d;
+    }
+    return gain[0];
+}
+
+// Static evaluation for the search, side-to-move perspective (higher is better): the
+// network when one is loaded and `useNnue` is set, otherwise the incremental tapered score
+// plus a few cheap positional terms, including the engine's taste for occupying the center.
+int evaluateStatic(const GameState &gs, bool whiteTurn, bool useNnue = true)
+{
+    if (useNnue && gs.accumulator)
+        return nnueEvaluate(gs, whiteTurn);
+    int score = evaluate(gs);
+    // bishop pair
+    if (popCount(gs.pieces[WHITE][BISHOP]) >= 2)
+        score += 30;
+    if (popCount(gs.pieces[BLACK][BISHOP]) >= 2)
+        score -= 30;
+    // center squares: d4,e4,d5,e5
+    const Bitboard center = squareBB(27) | squareBB(28) | squareBB(35) | squareBB(36);
+    score += (popCount(gs.occupancy[WHITE] & center) - popCount(gs.occupancy[BLACK] & center)) * 20;
+    return whiteTurn ? score : -score;
+}
+
+// Static ordering bonus for quiet moves: pawn double pushes on c/d/e, then center moves
+int quietMoveBonus(const Move &m)
+{
+    int score = 0;
+    // center target bonus
+    if (m.to() == 27 || m.to() == 28 || m.to() == 35 || m.to() == 36)
+        score += 500;
+
+    // prefer two-step pawn pushes on files c(2)/d(3)/e(4)
+    int fromFile = m.from() % 8;
+    if (m.flags() == FLAG_DOUBLE_PUSH && (fromFile == 2 || fromFile == 3 || fromFile == 4))
+        score += 5000; // very desirable
+    return score;
+}
+
+// --- Transposition table ---
+enum Bound : uint8_t
+{
+    BOUND_NONE = 0,
+    BOUND_UPPER = 1, // fail low: score is at most this value
+    BOUND_LOWER = 2, // fail high: score is at least this value
+    BOUND_EXACT = 3
+};
+
+// Snapshot of one hash entry. `data` packs move (16) | score (32) | depth (8) | bound (2) | generation (6).
+struct TTEntry
+{
+    uint64_t data = 0;
+
+    uint16_t move() const { return (uint16_t)data; }
+    int score() const { return (int32_t)(uint32_t)(data >> 16); }
+    int depth() const { return (int)(uint8_t)(data >> 48); }
+    Bound bound() const { return (Bound)((data >> 56) & 3); }
+    uint8_t generation() const { return (uint8_t)(data >> 58); }
+};
+
+// Shared slot, written by all search threads without locks. The key is stored xored with the
+// data, so a slot torn by two concurrent writers fails verification instead of returning
+// another position's data. Relaxed atomics compile to plain loads/stores on x86.
+struct TTSlot
+{
+    std::atomic<uint64_t> keyXorData;
+    std::atomic<uint64_t> data;
+};
+
+const int TTClusterSize = 4;
+
+// one cache line per probe: all slots that can hold a given key live together
+struct alignas(64) TTCluster
+{
+    TTSlot slot[TTClusterSize];
+};
+
+struct TranspositionTable
+{
+    TTCluster *clusters = nullptr;
+    size_t clusterCount = 0; // power of two
+    uint8_t generation = 0;  // bumped once per search, 6 bits used
+    bool largePages = false; // memory came from the huge/large page allocator
+
+    TranspositionTable() = default;
+    TranspositionTable(const TranspositionTable &) = delete;
+    TranspositionTable &operator=(const TranspositionTable &) = delete;
+    ~TranspositionTable() { release(); }
+
+    void resize(size_t mb, bool tryLargePages);
+    void release();
+    void clear() { std::memset((void *)clusters, 0, clusterCount * sizeof(TTCluster)); }
+    void newSearch() { generation = (generation + 1) & 63; }
+
+    TTCluster *clusterFor(uint64_t key) const { return &clusters[key & (clusterCount - 1)]; }
+
+    void prefetch(uint64_t key) const
+    {
+#if defined(_MSC_VER)
+        _mm_prefetch((const char *)clusterFor(key), _MM_HINT_T0);
+#else
+        __builtin_prefetch(clusterFor(key));
+#endif
+    }
+
+    // copies the entry for `key` into `out`; false if the position is not in the table
+    bool probe(uint64_t key, TTEntry &out) const
+    {
+        TTCluster *c = clusterFor(key);
+        for (int i = 0; i < TTClusterSize; ++i)
+        {
+            uint64_t data = c->slot[i].data.load(std::memory_order_relaxed);
+            if (data && (c->slot[i].keyXorData.load(std::memory_order_relaxed) ^ data) == key)
+            {
+                out.data = data;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(uint64_t key, int depth, int score, Bound bound, uint16_t move)
+    {
+        TTCluster *c = clusterFor(key);
+        TTSlot *replace = &c->slot[0];
+        TTEntry replaceEntry;
+        replaceEntry.data = replace->data.load(std::memory_order_relaxed);
+        bool samePosition = false;
+        for (int i = 0; i < TTClusterSize; ++i)
+        {
+            TTEntry e;
+            e.data = c->slot[i].data.load(std::memory_order_relaxed);
+            samePosition = e.data && (c->slot[i].keyXorData.load(std::memory_order_relaxed) ^ e.data) == key;
+            if (!e.data || samePosition)
+            {
+                replace = &c->slot[i];
+                replaceEntry = e;
+                break;
+            }
+            // depth-preferred, but entries from older searches lose 8 plies of value per generation
+            int age = (generation - e.generation()) & 63;
+            int replaceAge = (generation - replaceEntry.generation()) & 63;
+            if (e.depth() - 8 * age < replaceEntry.depth() - 8 * replaceAge)
+            {
+                replace = &c->slot[i];
+                replaceEntry = e;
+            }
+        }
+        // keep a known best move when the new result has none for the same position
+        if (!move && samePosition)
+            move = replaceEntry.move();
+        uint64_t data = (uint64_t)move | ((uint64_t)(uint32_t)score << 16) | ((uint64_t)(uint8_t)depth << 48) |
+                        ((uint64_t)bound << 56) | ((uint64_t)generation << 58);
+        replace->keyXorData.store(key ^ data, std::memory_order_relaxed);
+        replace->data.store(data, std::memory_order_relaxed);
+    }
+
+    // permille of sampled entries written during the current search
+    int hashfull() const
+    {
+        int used = 0;
+        for (size_t i = 0; i < 250 && i < clusterCount; ++i)
+            for (int j = 0; j < TTClusterSize; ++j)
+            {
+                TTEntry e;
+                e.data = clusters[i].slot[j].data.load(std::memory_order_relaxed);
+                used += e.data && e.generation() == generation;
+            }
+        return used;
+    }
+};
+
+void TranspositionTable::resize(size_t mb, bool tryLargePages)
+{
+    release();
+    size_t bytes = std::max<size_t>(mb, 1) * 1024 * 1024;
+    clusterCount = 1;
+    while (clusterCount * 2 * sizeof(TTCluster) <= bytes)
+        clusterCount *= 2;
+    bytes = clusterCount * sizeof(TTCluster);
+
+#if defined(_WIN32)
+    if (tryLargePages)
+    {
+        // needs the "Lock pages in memory" right; the privilege must also be enabled on the token
+        HANDLE token;
+        if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        {
+            TOKEN_PRIVILEGES tp{};
+            if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid))
+            {
+                tp.PrivilegeCount = 1;
+                tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+                AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr);
+            }
+            CloseHandle(token);
+        }
+        size_t page = GetLargePageMinimum();
+        if (page)
+        {
+            size_t rounded = (bytes + page - 1) / page * page;
+            clusters = (TTCluster *)VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            largePages = clusters != nullptr;
+        }
+    }
+    if (!clusters)
+        clusters = (TTCluster *)_aligned_malloc(bytes, 64);
+#else
+    // 2 MB alignment lets the kernel back the table with transparent huge pages
+    size_t alignment = tryLargePages ? 2 * 1024 * 1024 : 64;
+    size_t rounded = (bytes + alignment - 1) / alignment * alignment;
+    clusters = (TTCluster *)std::aligned_alloc(alignment, rounded);
+#if defined(MADV_HUGEPAGE)
+    if (clusters && tryLargePages)
+        largePages = madvise(clusters, rounded, MADV_HUGEPAGE) == 0;
+#endif
+#endif
+    if (!clusters)
+    {
+        std::cerr << "Failed to allocate " << mb << " MB transposition table\n";
+        std::exit(1);
+    }
+    clear();
+}
+
+void TranspositionTable::release()
+{
+    if (!clusters)
+        return;
+#if defined(_WIN32)
+    if (largePages)
+        VirtualFree(clusters, 0, MEM_RELEASE);
+    else
+        _aligned_free(clusters);
+#else
+    std::free(clusters);
+#endif
+    clusters = nullptr;
+    clusterCount = 0;
+    largePages = false;
+}
+
+TranspositionTable tt;
+
+// move the hash move (if present) to the front, keeping the heuristic order of the rest
+void orderHashMoveFirst(MoveList &moves, uint16_t hashMove)
+{
+    if (!hashMove)
+        return;
+    for (int i = 0; i < moves.size(); ++i)
+        if (moves[i].data == hashMove)
+        {
+            std::rotate(moves.begin(), moves.begin() + i, moves.begin() + i + 1);
+            return;
+        }
+}
+
+// --- Mapped files ---
+// Read-only view of a whole file. Mapping instead of reading lets multi-GB databases be
+// split and parsed in place, without copies, by any number of threads.
+struct MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path)
+    {
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER len;
+        if (!GetFileSizeEx(file, &len))
+            return false;
+        size = (size_t)len.QuadPart;
+        if (size == 0)
+            return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return false;
+        data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return false;
+        size = (size_t)st.st_size;
+        if (size == 0)
+            return true;
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = (const char *)p;
+#endif
+        return data != nullptr;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void *)data, size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// --- Endgame tablebases (--tb <dir>, --tb-generate <dir>) ---
+// Distance-to-mate tables for every ending with up to four men, built by retrograde analysis.
+// A table covers one material balance and is named like "KRvKP", with the stronger side as
+// white; the other color order is probed by mirroring the board. File "<name>.tb":
+//   8 bytes "CHSTB001", uint32 men, uint32 n (positions per side to move), then n bytes with
+//   white to move and n bytes with black to move, in tbIndex order
+// Each byte is 0 for a draw, 1..127 for a win with mate in that many moves, 128 + n for a loss
+// (mated in n moves; 128 is checkmate) and 255 for index slots that are no legal position.
+// Without pawns the board is reduced 8-fold (white king in a1-d1-d4: 462 king pairs), with
+// pawns by the a-h mirror only. Castling rights are not represented, en passant only when no
+// capture is possible, and the 50-move rule is ignored.
+const int TB_MAX_MEN = 4;
+const uint8_t TB_DRAW = 0;
+const uint8_t TB_INVALID = 255;
+const int TB_MAX_PLIES = 253; // longest mate a byte holds: a loss in 254 plies would read as TB_INVALID
+const char TB_MAGIC[8] = {'C', 'H', 'S', 'T', 'B', '0', '0', '1'};
+const size_t TB_HEADER_SIZE = 16;
+
+// Men in table order: white king, black king, then white and then black men from queen to pawn
+struct TbPosition
+{
+    int count = 0;
+    int type[TB_MAX_MEN], color[TB_MAX_MEN], sq[TB_MAX_MEN];
+    bool whiteToMove = true;
+};
+
+struct TbTable
+{
+    std::string name;
+    int count = 0;
+    int type[TB_MAX_MEN], color[TB_MAX_MEN];
+    bool pawns = false;
+    uint32_t code = 0; // tbMaterialCode of the men
+    uint32_t size = 0; // positions per side to move
+    const uint8_t *values = nullptr;
+    std::vector<uint8_t> owned; // while generating
+    MappedFile file;            // when loaded
+};
+
+std::vector<std::unique_ptr<TbTable>> tbTables;
+int tbMaxMen = 0; // largest table available, 0 without tablebases
+
+int tbTransform[8][64]; // the 8 board symmetries: mirror files (1), ranks (2), the a1-h8 diagonal (4)
+int tbKingTransforms[64][2], tbKingTransformCount[64]; // symmetries taking the white king into a1-d1-d4
+int tbKingPair[64][64];                                 // pawnless king pair index, -1 if not canonical
+int tbKingPairSquares[462][2];
+
+void initTablebaseIndex()
+{
+    for (int x = 0; x < 8; ++x)
+        for (int sq = 0; sq < 64; ++sq)
+        {
+            int f = sq % 8, r = sq / 8;
+            if (x & 1)
+                f = 7 - f;
+            if (x & 2)
+                r = 7 - r;
+            if (x & 4)
+                std::swap(f, r);
+            tbTransform[x][sq] = r * 8 + f;
+        }
+    for (int sq = 0; sq < 64; ++sq)
+    {
+        tbKingTransformCount[sq] = 0;
+        for (int x = 0; x < 8; ++x)
+        {
+            int t = tbTransform[x][sq];
+            if (t % 8 <= 3 && t / 8 <= t % 8 && tbKingTransformCount[sq] < 2)
+                tbKingTransforms[sq][tbKingTransformCount[sq]++] = x;
+        }
+    }
+    int n = 0;
+    for (int wk = 0; wk < 64; ++wk)
+        for (int bk = 0; bk < 64; ++bk)
+        {
+            tbKingPair[wk][bk] = -1;
+            bool triangle = wk % 8 <= 3 && wk / 8 <= wk % 8;
+            bool diagonal = wk % 8 == wk / 8;
+            if (!triangle || wk == bk || (kingAttacks[wk] & squareBB(bk)) || (diagonal && bk / 8 > bk % 8))
+                continue;
+            tbKingPairSquares[n][0] = wk;
+            tbKingPairSquares[n][1] = bk;
+            tbKingPair[wk][bk] = n++;
+        }
+}
+
+uint32_t tbMaterialCode(int count, const int *type, const int *color)
+{
+    uint32_t code = 0;
+    for (int i = 0; i < count; ++i)
+        if (type[i] != KING)
+            code += 1u << (3 * (color[i] * 5 + type[i]));
+    return code;
+}
+
+int tbRange(const TbTable &t, int i) { return t.type[i] == PAWN ? 48 : 64; }
+
+// Put `p` in table form: the stronger side white (mirroring the ranks if need be) and the men in table order
+void tbNormalize(TbPosition &p)
+{
+    // more men first, then the better men
+    auto strength = [&](int c)
+    {
+        int types[TB_MAX_MEN], n = 0;
+        for (int i = 0; i < p.count; ++i)
+            if (p.color[i] == c && p.type[i] != KING)
+                types[n++] = p.type[i];
+        for (int i = 1; i < n; ++i)
+            for (int j = i; j > 0 && types[j] > types[j - 1]; --j)
+                std::swap(types[j], types[j - 1]);
+        int s = n;
+        for (int i = 0; i < TB_MAX_MEN; ++i)
+            s = s * 8 + (i < n ? types[i] + 1 : 0);
+        return s;
+    };
+    if (strength(BLACK) > strength(WHITE))
+    {
+        for (int i = 0; i < p.count; ++i)
+        {
+            p.color[i] ^= 1;
+            p.sq[i] ^= 56;
+        }
+        p.whiteToMove = !p.whiteToMove;
+    }
+    auto rank = [&](int i) { return p.type[i] == KING ? p.color[i] : 2 + p.color[i] * 5 + (QUEEN - p.type[i]); };
+    for (int i = 1; i < p.count; ++i)
+        for (int j = i; j > 0 && rank(j) < rank(j - 1); --j)
+        {
+            std::swap(p.type[j], p.type[j - 1]);
+            std::swap(p.color[j], p.color[j - 1]);
+            std::swap(p.sq[j], p.sq[j - 1]);
+        }
+}
+
+// Index of the men on `sq` (table order) within one side-to-move half of the table: the
+// smallest over the symmetric images, so that every image of a position has the same index
+uint32_t tbIndex(const TbTable &t, const int *sq)
+{
+    uint32_t best = UINT32_MAX;
+    int transforms[2] = {sq[0] % 8 <= 3 ? 0 : 1, 0};
+    int count = 1;
+    if (!t.pawns)
+    {
+        count = tbKingTransformCount[sq[0]];
+        transforms[0] = tbKingTransforms[sq[0]][0];
+        transforms[1] = tbKingTransforms[sq[0]][1];
+    }
+    for (int k = 0; k < count; ++k)
+    {
+        int s[TB_MAX_MEN];
+        for (int i = 0; i < t.count; ++i)
+            s[i] = tbTransform[transforms[k]][sq[i]];
+        int kk = t.pawns ? ((s[0] / 8) * 4 + s[0] % 8) * 64 + s[1] : tbKingPair[s[0]][s[1]];
+        if (kk < 0)
+            continue;
+        // identical men are interchangeable: keep them in square order
+        for (int i = 2; i + 1 < t.count; ++i)
+            if (t.type[i] == t.type[i + 1] && t.color[i] == t.color[i + 1] && s[i] > s[i + 1])
+                std::swap(s[i], s[i + 1]);
+        uint32_t idx = kk;
+        for (int i = 2; i < t.count; ++i)
+            idx = idx * tbRange(t, i) + (t.type[i] == PAWN ? s[i] - 8 : s[i]);
+        best = std::min(best, idx);
+    }
+    return best;
+}
+
+void tbDecode(const TbTable &t, uint32_t idx, int *sq)
+{
+    for (int i = t.count - 1; i >= 2; --i)
+    {
+        int r = tbRange(t, i);
+        sq[i] = idx % r + (t.type[i] == PAWN ? 8 : 0);
+        idx /= r;
+    }
+    if (t.pawns)
+    {
+        sq[1] = idx % 64;
+        sq[0] = (idx / 64 / 4) * 8 + idx / 64 % 4;
+    }
+    else
+    {
+        sq[0] = tbKingPairSquares[idx][0];
+        sq[1] = tbKingPairSquares[idx][1];
+    }
+}
+
+// Layout of the table `name` ("KQvKR"); false if the name is not one
+bool tbLayout(const std::string &name, TbTable &t)
+{
+    size_t v = name.find('v');
+    if (name.size() < 4 || name[0] != 'K' || v == std::string::npos || v + 1 >= name.size() || name[v + 1] != 'K')
+        return false;
+    t.name = name;
+    t.count = 2;
+    t.type[0] = t.type[1] = KING;
+    t.color[0] = WHITE;
+    t.color[1] = BLACK;
+    t.pawns = false;
+    for (size_t i = 1; i < name.size(); ++i)
+    {
+        if (i == v || i == v + 1)
+            continue;
+        const char *letters = "PNBRQ";
+        const char *c = std::strchr(letters, name[i]);
+        if (!c || !*c || t.count == TB_MAX_MEN)
+            return false;
+        t.type[t.count] = (int)(c - letters);
+        t.color[t.count] = i < v ? WHITE : BLACK;
+        t.pawns |= t.type[t.count] == PAWN;
+        ++t.count;
+    }
+    t.code = tbMaterialCode(t.count, t.type, t.color);
+    t.size = t.pawns ? 2048 : 462;
+    for (int i = 2; i < t.count; ++i)
+        t.size *= tbRange(t, i);
+    return true;
+}
+
+const TbTable *tbFind(uint32_t code)
+{
+    for (const auto &t : tbTables)
+        if (t->code == code && t->values)
+            return t.get();
+    return nullptr;
+}
+
+// Table byte of a position (any color order and man order); TB_DRAW for bare kings,
+// TB_INVALID when no table covers it
+uint8_t tbProbePosition(TbPosition p)
+{
+    if (p.count == 2)
+        return TB_DRAW;
+    tbNormalize(p);
+    const TbTable *t = tbFind(tbMaterialCode(p.count, p.type, p.color));
+    if (!t)
+        return TB_INVALID;
+    uint32_t idx = tbIndex(*t, p.sq);
+    return idx == UINT32_MAX ? TB_INVALID : t->values[(p.whiteToMove ? 0 : t->size) + idx];
+}
+
+// Plies to mate of a table byte: > 0 win, < 0 loss (0 for checkmate), see tbValue
+int tbPlies(uint8_t v) { return v < 128 ? 2 * v - 1 : -2 * (v - 128); }
+
+uint8_t tbValue(int plies) { return plies > 0 ? (uint8_t)((plies + 1) / 2) : (uint8_t)(128 - plies / 2); }
+
+bool tbPositionFrom(const GameState &gs, bool whiteTurn, TbPosition &p)
+{
+    if (castlingBits(gs))
+        return false;
+    int us = whiteTurn ? WHITE : BLACK;
+    // an en passant square only matters if the capture is there
+    if (gs.enPassant >= 0 && (pawnAttacks[us ^ 1][gs.enPassant] & gs.pieces[us][PAWN]))
+        return false;
+    p.count = 0;
+    p.whiteToMove = whiteTurn;
+    for (int c = 0; c < 2; ++c)
+        for (int t = KING; t >= PAWN; --t)
+            for (Bitboard b = gs.pieces[c][t]; b;)
+            {
+                if (p.count == TB_MAX_MEN)
+                    return false;
+                p.type[p.count] = t;
+                p.color[p.count] = c;
+                p.sq[p.count++] = popLsb(b);
+            }
+    return true;
+}
+
+// Result of the position for the side to move from the tablebases: wdl 1, 0 or -1 and,
+// unless drawn, the plies to mate. False when no table covers the position.
+bool probeTablebase(const GameState &gs, bool whiteTurn, int &wdl, int &plies)
+{
+    TbPosition p;
+    if (!tbMaxMen || !tbPositionFrom(gs, whiteTurn, p) || p.count > tbMaxMen)
+        return false;
+    uint8_t v = tbProbePosition(p);
+    if (v == TB_INVALID)
+        return false;
+    plies = v == TB_DRAW ? 0 : std::abs(tbPlies(v));
+    wdl = v == TB_DRAW ? 0 : v < 128 ? 1 : -1;
+    return true;
+}
+
+// The best root move by the tablebases: the fastest win, any draw, or the slowest loss.
+// False if the root or one of its successors is not covered.
+bool tablebaseRootMove(GameState &gs, bool whiteTurn, const MoveList &moves, Move &best, int &wdl, int &plies)
+{
+    int bestKey = INT32_MIN;
+    for (int i = 0; i < moves.count; ++i)
+    {
+        Undo u;
+        makeMove(gs, moves.moves[i], u);
+        int cw, cp;
+        bool found = probeTablebase(gs, !whiteTurn, cw, cp);
+        unmakeMove(gs, moves.moves[i], u);
+        if (!found)
+            return false;
+        int w = -cw, p = cw ? cp + 1 : 0;
+        int key = w > 0 ? 1000 - p : w < 0 ? -1000 + p : 0;
+        if (key > bestKey)
+        {
+            bestKey = key;
+            best = moves.moves[i];
+            wdl = w;
+            plies = p;
+        }
+    }
+    return bestKey != INT32_MIN;
+}
+
+bool loadTablebases(const std::string &dir)
+{
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (entry.path().extension() != ".tb")
+            continue;
+        auto t = std::make_unique<TbTable>();
+        uint32_t men = 0, size = 0;
+        if (!tbLayout(entry.path().stem().string(), *t) || !t->file.open(entry.path().string()) ||
+            t->file.size < TB_HEADER_SIZE || std::memcmp(t->file.data, TB_MAGIC, 8) != 0)
+            continue;
+        std::memcpy(&men, t->file.data + 8, 4);
+        std::memcpy(&size, t->file.data + 12, 4);
+        if ((int)men != t->count || size != t->size || t->file.size != TB_HEADER_SIZE + 2 * (size_t)size)
+            continue;
+        t->values = (const uint8_t *)t->file.data + TB_HEADER_SIZE;
+        tbMaxMen = std::max(tbMaxMen, t->count);
+        tbTables.push_back(std::move(t));
+    }
+    return !tbTables.empty();
+}
+
+// --- Tablebase generation ---
+Bitboard tbAttacks(int type, int color, int sq, Bitboard occ)
+{
+    switch (type)
+    {
+    case PAWN:
+        return pawnAttacks[color][sq];
+    case KNIGHT:
+        return knightAttacks[sq];
+    case BISHOP:
+        return bishopAttacks(sq, occ);
+    case ROOK:
+        return rookAttacks(sq, occ);
+    case QUEEN:
+        return queenAttacks(sq, occ);
+    default:
+        return kingAttacks[sq];
+    }
+}
+
+Bitboard tbOccupancy(const TbPosition &p)
+{
+    Bitboard occ = 0;
+    for (int i = 0; i < p.count; ++i)
+        occ |= squareBB(p.sq[i]);
+    return occ;
+}
+
+// Is the king of `color` attacked?
+bool tbInCheck(const TbPosition &p, int color)
+{
+    Bitboard occ = tbOccupancy(p);
+    int king = p.sq[color == WHITE ? 0 : 1];
+    for (int i = 2; i < p.count; ++i)
+        if (p.color[i] != color && (tbAttacks(p.type[i], p.color[i], p.sq[i], occ) & squareBB(king)))
+            return true;
+    return (kingAttacks[p.sq[color == WHITE ? 1 : 0]] & squareBB(king)) != 0;
+}
+
+// Legal en passant captures of the opponent's pawn `i`, as if it had just made a double step
+int tbEnPassantCaptures(const TbPosition &p, int i, TbPosition *out)
+{
+    int us = p.whiteToMove ? WHITE : BLACK;
+    int behind = p.sq[i] + (us == WHITE ? 8 : -8);
+    int n = 0;
+    for (int j = 0; j < p.count; ++j)
+    {
+        if (p.color[j] != us || p.type[j] != PAWN || !(pawnAttacks[us][p.sq[j]] & squareBB(behind)))
+            continue;
+        TbPosition c = p;
+        c.sq[j] = behind;
+        for (int k = i; k + 1 < c.count; ++k)
+        {
+            c.type[k] = c.type[k + 1];
+            c.color[k] = c.color[k + 1];
+            c.sq[k] = c.sq[k + 1];
+        }
+        --c.count;
+        c.whiteToMove = !p.whiteToMove;
+        if (!tbInCheck(c, us))
+            out[n++] = c;
+    }
+    return n;
+}
+
+// The opponent's pawn that could have just made a double step and could be taken en passant,
+// -1 if none. With four men there is at most one.
+int tbEnPassantPawn(const TbPosition &p)
+{
+    int them = p.whiteToMove ? BLACK : WHITE;
+    int step = them == WHITE ? 8 : -8;
+    Bitboard occ = tbOccupancy(p);
+    TbPosition captures[2];
+    for (int i = 2; i < p.count; ++i)
+        if (p.color[i] == them && p.type[i] == PAWN && p.sq[i] / 8 == (them == WHITE ? 3 : 4) &&
+            !(occ & (squareBB(p.sq[i] - step) | squareBB(p.sq[i] - 2 * step))) && tbEnPassantCaptures(p, i, captures))
+            return i;
+    return -1;
+}
+
+// All legal successors; `conversion` marks captures and promotions, which leave the table.
+// With `enPassant` the opponent's last move was the double step of tbEnPassantPawn.
+int tbChildren(const TbPosition &p, bool enPassant, TbPosition *out, bool *conversion)
+{
+    int us = p.whiteToMove ? WHITE : BLACK;
+    Bitboard occ = tbOccupancy(p), own = 0;
+    for (int i = 0; i < p.count; ++i)
+        if (p.color[i] == us)
+            own |= squareBB(p.sq[i]);
+    int n = 0;
+    auto add = [&](int i, int to, int promotion)
+    {
+        TbPosition c = p;
+        bool converts = promotion != PAWN;
+        for (int j = 0; j < c.count; ++j)
+            if (j != i && c.sq[j] == to)
+            {
+                for (int k = j; k + 1 < c.count; ++k)
+                {
+                    c.type[k] = c.type[k + 1];
+                    c.color[k] = c.color[k + 1];
+                    c.sq[k] = c.sq[k + 1];
+                }
+                --c.count;
+                if (j < i)
+                    --i;
+                converts = true;
+                break;
+            }
+        c.sq[i] = to;
+        c.type[i] = promotion == PAWN ? c.type[i] : promotion;
+        c.whiteToMove = !p.whiteToMove;
+        if (tbInCheck(c, us))
+            return;
+        conversion[n] = converts;
+        out[n++] = c;
+    };
+    for (int i = 0; i < p.count; ++i)
+    {
+        if (p.color[i] != us)
+            continue;
+        int from = p.sq[i];
+        Bitboard targets;
+        if (p.type[i] == PAWN)
+        {
+            int step = us == WHITE ? 8 : -8;
+            targets = pawnAttacks[us][from] & occ & ~own;
+            if (!(occ & squareBB(from + step)))
+            {
+                targets |= squareBB(from + step);
+                int startRank = us == WHITE ? 1 : 6;
+                if (from / 8 == startRank && !(occ & squareBB(from + 2 * step)))
+                    targets |= squareBB(from + 2 * step);
+            }
+        }
+        else
+            targets = tbAttacks(p.type[i], us, from, occ) & ~own;
+        while (targets)
+        {
+            int to = popLsb(targets);
+            if (p.type[i] == PAWN && (to / 8 == 0 || to / 8 == 7))
+                for (int promotion = QUEEN; promotion >= KNIGHT; --promotion)
+                    add(i, to, promotion);
+            else
+                add(i, to, PAWN);
+        }
+    }
+    if (enPassant)
+    {
+        int captures = tbEnPassantCaptures(p, tbEnPassantPawn(p), out + n);
+        std::fill(conversion + n, conversion + n + captures, true);
+        n += captures;
+    }
+    return n;
+}
+
+// Distinct indices of the positions (other side to move) with a quiet move to `p`. A double
+// step that allows en passant leads to the variant of `p` at index + 2 * t.size, which is `p`
+// with `enPassant`; a parent that could itself take en passant has that variant too.
+int tbParents(const TbTable &t, const TbPosition &p, bool enPassant, uint32_t *out)
+{
+    int them = p.whiteToMove ? BLACK : WHITE; // the side that just moved
+    int us = them ^ 1;
+    Bitboard occ = tbOccupancy(p);
+    int epPawn = tbEnPassantPawn(p);
+    int n = 0;
+    for (int i = 0; i < p.count; ++i)
+    {
+        if (p.color[i] != them || (enPassant && i != epPawn))
+            continue;
+        int to = p.sq[i];
+        Bitboard origins;
+        if (p.type[i] == PAWN)
+        {
+            int step = them == WHITE ? -8 : 8;
+            int from = to + step;
+            origins = 0;
+            bool onBoard = them == WHITE ? from >= 8 : from < 56;
+            if (onBoard && !(occ & squareBB(from)))
+            {
+                if (!enPassant)
+                    origins |= squareBB(from);
+                int doubleRank = them == WHITE ? 3 : 4;
+                if (to / 8 == doubleRank && !(occ & squareBB(from + step)) && enPassant == (i == epPawn))
+                    origins |= squareBB(from + step);
+            }
+        }
+        else
+            origins = tbAttacks(p.type[i], them, to, occ) & ~occ;
+        while (origins)
+        {
+            TbPosition q = p;
+            q.sq[i] = popLsb(origins);
+            q.whiteToMove = !p.whiteToMove;
+            if (tbInCheck(q, us))
+                continue;
+            out[n] = (q.whiteToMove ? 0 : t.size) + tbIndex(t, q.sq);
+            if (tbEnPassantPawn(q) >= 0)
+            {
+                out[n + 1] = out[n] + 2 * t.size;
+                ++n;
+            }
+            ++n;
+        }
+    }
+    std::sort(out, out + n);
+    return (int)(std::unique(out, out + n) - out);
+}
+
+// Fill t.owned by retrograde analysis. Every table reachable by a capture or promotion must
+// already be in tbTables. Positions are finalized in order of their distance to mate: a
+// position lost in d plies makes its parents won in d + 1; a parent whose last undecided
+// quiet move turns out won for the opponent is lost, in one ply more than its longest defence.
+// With pawns on both sides, positions right after a double step that allows en passant are
+// solved as their own nodes after the table and dropped from the file: probes never see them.
+// False if a mate is longer than TB_MAX_PLIES and so cannot be stored.
+bool generateTablebase(TbTable &t, int threads)
+{
+    const uint32_t total = 2 * t.size;
+    bool pawns[2] = {false, false};
+    for (int i = 2; i < t.count; ++i)
+        pawns[t.color[i]] |= t.type[i] == PAWN;
+    const uint32_t nodes = pawns[WHITE] && pawns[BLACK] ? 2 * total : total;
+    t.owned.assign(nodes, TB_INVALID);
+    std::vector<uint8_t> moves(nodes, 0);    // quiet moves not yet known to lose
+    std::vector<uint8_t> convLoss(nodes, 0); // longest loss through a capture or promotion
+    std::vector<uint8_t> saved(nodes, 0);    // a capture or promotion that does not lose
+    std::vector<std::vector<uint32_t>> levels(256);
+    threads = std::max(1, threads);
+
+    auto positionAt = [&](uint32_t i, TbPosition &p)
+    {
+        p.count = t.count;
+        for (int k = 0; k < t.count; ++k)
+        {
+            p.type[k] = t.type[k];
+            p.color[k] = t.color[k];
+        }
+        p.whiteToMove = i % total < t.size;
+        tbDecode(t, i % t.size, p.sq);
+    };
+
+    // every position: legality, immediate results and results through captures and promotions
+    std::vector<std::vector<std::pair<int, uint32_t>>> pending(threads);
+    std::vector<std::thread> pool;
+    for (int w = 0; w < threads; ++w)
+        pool.emplace_back([&, w]()
+                          {
+            TbPosition children[256];
+            bool conversion[256];
+            uint32_t quiet[256];
+            for (uint32_t i = w; i < nodes; i += threads)
+            {
+                TbPosition p;
+                positionAt(i, p);
+                bool enPassant = i >= total;
+                if (popCount(tbOccupancy(p)) != p.count || tbIndex(t, p.sq) != i % t.size ||
+                    tbInCheck(p, p.whiteToMove ? BLACK : WHITE) || (enPassant && tbEnPassantPawn(p) < 0))
+                    continue;
+                t.owned[i] = TB_DRAW;
+                int n = tbChildren(p, enPassant, children, conversion);
+                int win = 0, lossPlies = 0, quietCount = 0;
+                for (int c = 0; c < n; ++c)
+                {
+                    if (!conversion[c])
+                    {
+                        int k = tbEnPassantPawn(children[c]);
+                        bool doubleStep = k >= 0 && std::abs(children[c].sq[k] - p.sq[k]) == 16;
+                        quiet[quietCount++] = (children[c].whiteToMove ? 0 : t.size) + tbIndex(t, children[c].sq) +
+                                              (doubleStep ? total : 0);
+                        continue;
+                    }
+                    uint8_t v = tbProbePosition(children[c]);
+                    if (v == TB_DRAW || v == TB_INVALID)
+                        saved[i] = 1;
+                    else if (v >= 128) // the opponent is mated: a win for us
+                    {
+                        saved[i] = 1;
+                        int plies = -tbPlies(v) + 1;
+                        win = win ? std::min(win, plies) : plies;
                     }
                     else
-                        addMove(moves, i, i + 7, true);
+                        lossPlies = std::max(lossPlies, tbPlies(v) + 1);
+                }
+                std::sort(quiet, quiet + quietCount);
+                moves[i] = (uint8_t)(std::unique(quiet, quiet + quietCount) - quiet);
+                convLoss[i] = (uint8_t)lossPlies;
+                if (n == 0 && tbInCheck(p, p.whiteToMove ? WHITE : BLACK))
+                    pending[w].push_back({0, i});
+                else if (win)
+                    pending[w].push_back({win, i});
+                else if (n > 0 && moves[i] == 0 && !saved[i])
+                    pending[w].push_back({lossPlies, i});
+            } });
+    for (auto &th : pool)
+        th.join();
+    for (auto &list : pending)
+        for (auto &e : list)
+            levels[e.first].push_back(e.second);
+
+    // retrograde propagation, one distance at a time; parents are found in parallel
+    std::vector<uint8_t> done(nodes, 0);
+    for (int d = 0; d <= TB_MAX_PLIES; ++d)
+    {
+        std::vector<uint32_t> now;
+        for (uint32_t i : levels[d])
+            if (!done[i])
+            {
+                done[i] = 1;
+                t.owned[i] = tbValue(d % 2 ? d : -d);
+                now.push_back(i);
+            }
+        std::vector<uint32_t>().swap(levels[d]);
+        if (now.empty())
+            continue;
+        std::vector<std::vector<uint32_t>> parents(threads);
+        pool.clear();
+        for (int w = 0; w < threads; ++w)
+            pool.emplace_back([&, w]()
+                              {
+                uint32_t buf[256];
+                for (size_t k = w; k < now.size(); k += threads)
+                {
+                    TbPosition p;
+                    positionAt(now[k], p);
+                    int n = tbParents(t, p, now[k] >= total, buf);
+                    parents[w].insert(parents[w].end(), buf, buf + n);
+                } });
+        for (auto &th : pool)
+            th.join();
+        // a parent list per position holds each parent once, so the counts stay exact
+        for (auto &list : parents)
+            for (uint32_t q : list)
+            {
+                if (done[q] || t.owned[q] == TB_INVALID)
+                    continue;
+                if (d % 2 == 0)
+                    levels[d + 1].push_back(q);
+                else if (moves[q] && --moves[q] == 0 && !saved[q])
+                    levels[std::max(d + 1, (int)convLoss[q])].push_back(q);
+            }
+    }
+    for (int d = TB_MAX_PLIES + 1; d < (int)levels.size(); ++d)
+        for (uint32_t i : levels[d])
+            if (!done[i])
+                return false;
+    t.owned.resize(total);
+    t.owned.shrink_to_fit();
+    t.values = t.owned.data();
+    return true;
+}
+
+// All tables with up to `men` men, each after the tables its captures and promotions lead to
+std::vector<std::string> tablebaseNames(int men)
+{
+    const char *letters = "QRBNP";
+    std::vector<std::string> sides = {""};
+    for (int a = 0; a < 5; ++a)
+    {
+        sides.push_back(std::string(1, letters[a]));
+        for (int b = a; b < 5; ++b)
+            sides.push_back(std::string(1, letters[a]) + letters[b]);
+    }
+    std::vector<std::pair<std::pair<int, int>, std::string>> names;
+    for (const std::string &w : sides)
+        for (const std::string &b : sides)
+        {
+            int count = 2 + (int)(w.size() + b.size());
+            if (count < 3 || count > men)
+                continue;
+            TbTable t;
+            tbLayout("K" + w + "vK" + b, t);
+            TbPosition p;
+            p.count = t.count;
+            for (int i = 0; i < t.count; ++i)
+            {
+                p.type[i] = t.type[i];
+                p.color[i] = t.color[i];
+                p.sq[i] = 0;
+            }
+            TbPosition q = p;
+            tbNormalize(q);
+            if (tbMaterialCode(q.count, q.type, q.color) != t.code)
+                continue; // the stronger side is black: covered by the mirrored table
+            int pawns = (int)std::count(w.begin(), w.end(), 'P') + (int)std::count(b.begin(), b.end(), 'P');
+            names.push_back({{count, pawns}, t.name});
+        }
+    std::sort(names.begin(), names.end());
+    std::vector<std::string> out;
+    for (auto &n : names)
+        out.push_back(n.second);
+    return out;
+}
+
+// --tb-generate: write all tables with up to `men` men to `dir`
+bool generateTablebases(const std::string &dir, int men, int threads)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    tbTables.clear();
+    tbMaxMen = 0;
+    for (const std::string &name : tablebaseNames(std::min(men, TB_MAX_MEN)))
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto t = std::make_unique<TbTable>();
+        tbLayout(name, *t);
+        if (!generateTablebase(*t, threads))
+        {
+            std::cout << name << ": mates longer than " << TB_MAX_PLIES << " plies do not fit the table format\n";
+            return false;
+        }
+        uint64_t wins = 0, draws = 0, losses = 0;
+        int longest = 0;
+        for (uint8_t v : t->owned)
+        {
+            if (v == TB_INVALID)
+                continue;
+            if (v == TB_DRAW)
+                ++draws;
+            else
+            {
+                ++(v < 128 ? wins : losses);
+                longest = std::max(longest, std::abs(tbPlies(v)));
+            }
+        }
+        std::string path = (std::filesystem::path(dir) / (name + ".tb")).string();
+        std::ofstream f(path, std::ios::binary);
+        uint32_t header[2] = {(uint32_t)t->count, t->size};
+        f.write(TB_MAGIC, 8);
+        f.write((const char *)header, sizeof(header));
+        f.write((const char *)t->owned.data(), t->owned.size());
+        if (!f)
+        {
+            std::cout << "Cannot write " << path << "\n";
+            return false;
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::printf("%-7s %9llu wins %9llu draws %9llu losses, longest mate %3d plies, %.1f s\n", name.c_str(),
+                    (unsigned long long)wins, (unsigned long long)draws, (unsigned long long)losses, longest, secs);
+        std::fflush(stdout);
+        tbMaxMen = std::max(tbMaxMen, t->count);
+        tbTables.push_back(std::move(t));
+    }
+    return true;
+}
+
+// --- Search ---
+const int MATE_SCORE = 100000;
+const int INF_SCORE = 1000000;
+const int MAX_PLY = 128;
+// scores at least this far from zero are mates: found by the search within MAX_PLY plies,
+// or by a tablebase probe at any ply with up to TB_MAX_PLIES more to go
+const int MATE_BOUND = MATE_SCORE - MAX_PLY - TB_MAX_PLIES;
+
+// mate scores are stored relative to the node, not the root, so they stay valid at any ply
+int scoreToTT(int score, int ply)
+{
+    if (score >= MATE_BOUND)
+        return score + ply;
+    if (score <= -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+int scoreFromTT(int score, int ply)
+{
+    if (score >= MATE_BOUND)
+        return score - ply;
+    if (score <= -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+// Search techniques that can be switched off from the command line (--no-pvs, --no-null-move,
+// --no-lmr, --no-check-extensions) to measure what each one buys with --bench, or per side
+// in a --match.
+struct SearchFeatures
+{
+    bool pvs = true;             // zero-window search of all but the first move, re-search on fail high
+    bool nullMove = true;        // adaptive null move pruning
+    bool lmr = true;             // late move reductions for quiet moves
+    bool checkExtensions = true; // search moves that give check one ply deeper
+    bool nnue = true;            // evaluate with the network, if one is loaded
+};
+SearchFeatures searchFeatures;
+
+// late move reduction in plies by [depth][number of moves searched before], from initSearchTables
+int lmrReductions[64][64];
+
+void initSearchTables()
+{
+    for (int d = 1; d < 64; ++d)
+        for (int n = 1; n < 64; ++n)
+            lmrReductions[d][n] = (int)(0.75 + std::log((double)d) * std::log((double)n) / 2.25);
+}
+
+// Limits for one searchBestMove call. Zero means "no limit" for the time and node fields.
+struct SearchLimits
+{
+    int depth = MAX_PLY - 1;
+    int64_t softMs = 0; // don't start another iteration after this much time
+    int64_t hardMs = 0; // abort the running iteration at this point
+    uint64_t nodes = 0;
+    bool report = false; // print an info line after every completed iteration of the main thread
+    std::atomic<bool> *stop = nullptr;   // set from outside (UCI "stop") to end the search at once
+    std::atomic<bool> *ponder = nullptr; // while set, the clock is ignored; it restarts when cleared (ponderhit)
+};
+
+struct SearchResult
+{
+    Move bestMove = Move{};
+    int score = 0;
+    int depth = 0; // last fully completed iteration
+    uint64_t nodes = 0;
+    int64_t elapsedMs = 0;
+    std::vector<Move> pv; // expected line, starting with bestMove
+};
+
+struct SearchContext
+{
+    SearchLimits limits;
+    std::chrono::steady_clock::time_point start;
+    uint64_t nodes = 0;
+    bool stopped = false;
+    std::atomic<bool> *stop = nullptr; // shared by all threads searching the same root
+    TranspositionTable *tt = nullptr;   // shared by all threads searching the same root
+    const SearchFeatures *features = &searchFeatures;
+
+    // move ordering state, private to the thread
+    Move killers[MAX_PLY][2] = {};      // quiet moves that caused a beta cutoff at this ply
+    int history[2][64][64] = {};        // butterfly table [color][from][to] for quiet moves
+
+    // triangular principal variation table: pv[ply][ply..pvLength[ply]) is the best line from ply
+    Move pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY];
+
+    // NNUE accumulators by ply, allocated on the first search that evaluates with the network
+    std::vector<NnueAccumulator> accumulators;
+
+    int64_t elapsedMs() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // true while pondering; on the first call after the ponderhit the clock starts over
+    bool pondering()
+    {
+        if (!limits.ponder || ponderhitSeen)
+            return false;
+        if (limits.ponder->load(std::memory_order_relaxed))
+            return true;
+        ponderhitSeen = true;
+        start = std::chrono::steady_clock::now();
+        return false;
+    }
+    bool ponderhitSeen = false;
+
+    // cheap enough to call every node; only looks at the clock every 2048 nodes
+    bool shouldStop()
+    {
+        if (stopped)
+            return true;
+        if (stop && stop->load(std::memory_order_relaxed))
+            stopped = true;
+        else if (limits.stop && limits.stop->load(std::memory_order_relaxed))
+            stopped = true;
+        else if (limits.nodes && nodes >= limits.nodes)
+            stopped = true;
+        else if (limits.hardMs && (nodes & 2047) == 0 && !pondering() && elapsedMs() >= limits.hardMs)
+            stopped = true;
+        return stopped;
+    }
+};
+
+// --- Move ordering ---
+const int HASH_MOVE_SCORE = 1 << 30;
+const int CAPTURE_SCORE = 1 << 24;  // + MVV-LVA
+const int KILLER_SCORE = 1 << 20;   // first killer; the second one scores one less
+const int HISTORY_MAX = 1 << 14;    // history values stay within [-HISTORY_MAX, HISTORY_MAX]
+
+// Score every move once so the search can pick them lazily with MoveList::pickNext:
+// hash move, captures and queen promotions by MVV-LVA, killers, quiet moves by history
+// plus the static bonus, then captures that lose material. Underpromotions go last.
+void scoreMoves(const SearchContext &ctx, const GameState &gs, MoveList &moves, int ply, uint16_t hashMove)
+{
+    for (int i = 0; i < moves.size(); ++i)
+    {
+        const Move m = moves[i];
+        int score;
+        if (m.data == hashMove)
+            score = HASH_MOVE_SCORE;
+        else if (m.isCapture() || (m.isPromotion() && m.promotionType() == QUEEN))
+        {
+            int attacker = pieceTypeOf(gs.board[m.from()]);
+            int victim = m.isEnPassant() ? PAWN : m.isCapture() ? pieceTypeOf(gs.board[m.to()]) : PAWN;
+            score = CAPTURE_SCORE + victim * 8 - attacker;
+            if (m.isPromotion())
+                score += QUEEN * 8;
+            // captures losing material by SEE go after the quiet moves
+            else if (pieceMaterial[victim] < pieceMaterial[attacker] && see(gs, m) < 0)
+                score -= CAPTURE_SCORE + KILLER_SCORE;
+        }
+        else if (m.isPromotion())
+            score = -HASH_MOVE_SCORE + m.promotionType();
+        else if (ply < MAX_PLY && m == ctx.killers[ply][0])
+            score = KILLER_SCORE;
+        else if (ply < MAX_PLY && m == ctx.killers[ply][1])
+            score = KILLER_SCORE - 1;
+        else
+        {
+            int us = isWhite(gs.board[m.from()]) ? WHITE : BLACK;
+            score = ctx.history[us][m.from()][m.to()] + quietMoveBonus(m);
+        }
+        moves.scores[i] = score;
+    }
+}
+
+// `m` is the new best move at `ply`: the line from here is m followed by the child's line
+void updatePv(SearchContext &ctx, int ply, Move m)
+{
+    ctx.pv[ply][ply] = m;
+    for (int j = ply + 1; j < ctx.pvLength[ply + 1]; ++j)
+        ctx.pv[ply][j] = ctx.pv[ply + 1][j];
+    ctx.pvLength[ply] = std::max(ctx.pvLength[ply + 1], ply + 1);
+}
+
+// gravity update: large bonuses saturate instead of overflowing the table
+void updateHistory(int &entry, int bonus)
+{
+    entry += bonus - entry * std::abs(bonus) / HISTORY_MAX;
+}
+
+// A quiet move caused a beta cutoff: remember it as a killer and reward it in the history
+// table, while the quiet moves searched before it (`quiets`) are penalized.
+void updateQuietStats(SearchContext &ctx, int us, int ply, int depth, Move best, const Move *quiets, int quietCount)
+{
+    if (ply < MAX_PLY && ctx.killers[ply][0] != best)
+    {
+        ctx.killers[ply][1] = ctx.killers[ply][0];
+        ctx.killers[ply][0] = best;
+    }
+    int bonus = std::min(depth * depth, HISTORY_MAX);
+    updateHistory(ctx.history[us][best.from()][best.to()], bonus);
+    for (int i = 0; i < quietCount; ++i)
+        updateHistory(ctx.history[us][quiets[i].from()][quiets[i].to()], -bonus);
+}
+
+const int DELTA_MARGIN = 200; // centipawns on top of the captured piece for delta pruning
+
+// Quiescence search: resolve captures and queen promotions at the horizon so leaves are
+// tactically quiet. The side to move may stand pat on the static evaluation unless in
+// check, in which case every evasion is searched and mate is detected.
+int quiescence(SearchContext &ctx, GameState &gs, bool whiteTurn, int ply, int alpha, int beta)
+{
+    ctx.pvLength[ply] = ply;
+    ++ctx.nodes;
+    if (ctx.shouldStop())
+        return 0;
+
+    int kingSq = findKingSquare(gs, whiteTurn);
+    bool inCheck = kingSq != -1 && isSquareAttacked(gs, kingSq, !whiteTurn);
+    if (ply >= MAX_PLY - 1)
+        return evaluateStatic(gs, whiteTurn, ctx.features->nnue);
+
+    int standPat = -INF_SCORE;
+    int best = -INF_SCORE;
+    MoveList moves;
+    if (inCheck)
+        generateLegalMoves(gs, whiteTurn, moves);
+    else
+    {
+        standPat = best = evaluateStatic(gs, whiteTurn, ctx.features->nnue);
+        if (standPat >= beta)
+            return standPat;
+        if (standPat > alpha)
+            alpha = standPat;
+        generateLegal(gs, whiteTurn, &moves, GEN_TACTICAL);
+    }
+    scoreMoves(ctx, gs, moves, ply, 0);
+
+    for (int i = 0; i < moves.size(); ++i)
+    {
+        const Move m = moves.pickNext(i);
+        if (!inCheck)
+        {
+            if (m.isPromotion() && m.promotionType() != QUEEN)
+                continue;
+            // delta pruning: even winning the piece with a margin to spare cannot raise alpha
+            int gain = m.isEnPassant() ? pieceMaterial[PAWN] : m.isCapture() ? pieceMaterial[pieceTypeOf(gs.board[m.to()])] : 0;
+            if (m.isPromotion())
+                gain += pieceMaterial[QUEEN] - pieceMaterial[PAWN];
+            if (standPat + gain * 100 + DELTA_MARGIN <= alpha)
+                continue;
+            if (see(gs, m) < 0)
+                continue;
+        }
+        Undo u;
+        makeMove(gs, m, u);
+        int val = -quiescence(ctx, gs, !whiteTurn, ply + 1, -beta, -alpha);
+        unmakeMove(gs, m, u);
+        if (ctx.stopped)
+            return 0;
+        if (val > best)
+            best = val;
+        if (best > alpha)
+            alpha = best;
+        if (alpha >= beta)
+            break;
+    }
+
+    if (inCheck && best == -INF_SCORE)
+        return -MATE_SCORE + ply; // no evasion
+    return best;
+}
+
+// `gs` is searched in place with makeMove/unmakeMove and is unchanged on return.
+// Once ctx.stopped is set the returned value is meaningless and must be discarded.
+// `allowNull` is false right after a null move so two passes never follow each other.
+int negamax(SearchContext &ctx, GameState &gs, bool whiteTurn, int depth, int ply, int alpha, int beta, bool allowNull = true)
+{
+    if (depth <= 0)
+        return quiescence(ctx, gs, whiteTurn, ply, alpha, beta);
+    ctx.pvLength[ply] = ply;
+    ++ctx.nodes;
+    if (ctx.shouldStop())
+        return 0;
+    if (ply >= MAX_PLY - 1)
+        return evaluateStatic(gs, whiteTurn, ctx.features->nnue);
+
+    // endgame tablebases: the exact distance to mate, no search needed
+    int wdl, tbPliesToMate;
+    if (ply > 0 && popCount(occupied(gs)) <= tbMaxMen && probeTablebase(gs, whiteTurn, wdl, tbPliesToMate))
+        return wdl * (MATE_SCORE - ply - tbPliesToMate);
+
+    const int alphaOrig = alpha;
+    const bool pvNode = beta - alpha > 1;
+    uint16_t hashMove = 0;
+    TTEntry e;
+    if (ctx.tt->probe(gs.key, e))
+    {
+        hashMove = e.move();
+        int s = scoreFromTT(e.score(), ply);
+        // no cutoffs on the PV, so that the principal variation is searched out in full
+        if (!pvNode && e.depth() >= depth &&
+            (e.bound() == BOUND_EXACT || (e.bound() == BOUND_LOWER && s >= beta) || (e.bound() == BOUND_UPPER && s <= alpha)))
+            return s;
+    }
+
+    const int us = whiteTurn ? WHITE : BLACK;
+    int kingSq = findKingSquare(gs, whiteTurn);
+    bool inCheck = (kingSq != -1) && isSquareAttacked(gs, kingSq, !whiteTurn);
+
+    // null move pruning: if passing still fails high, a real move will too. Not in check,
+    // not on the PV, and only with pieces left, since in pawn endings zugzwang is common;
+    // deep cutoffs are verified by a reduced search without null moves.
+    bool hasPieces = gs.material[us] - popCount(gs.pieces[us][PAWN]) * pieceMaterial[PAWN] > 0;
+    if (ctx.features->nullMove && allowNull && !pvNode && !inCheck && depth >= 3 && hasPieces &&
+        std::abs(beta) < MATE_BOUND && evaluateStatic(gs, whiteTurn, ctx.features->nnue) >= beta)
+    {
+        int r = 3 + depth / 6;
+        Undo u;
+        makeNullMove(gs, u);
+        int val = -negamax(ctx, gs, !whiteTurn, depth - 1 - r, ply + 1, -beta, -beta + 1, false);
+        unmakeNullMove(gs, u);
+        if (ctx.stopped)
+            return 0;
+        if (val >= beta)
+        {
+            if (depth < 8 || negamax(ctx, gs, whiteTurn, depth - 1 - r, ply, beta - 1, beta, false) >= beta)
+                return beta;
+            if (ctx.stopped)
+                return 0;
+        }
+    }
+
+    MoveList moves;
+    generateLegalMoves(gs, whiteTurn, moves);
+    if (moves.empty())
+        return inCheck ? -MATE_SCORE + ply : 0; // checkmate (the quicker the worse) or stalemate
+
+    scoreMoves(ctx, gs, moves, ply, hashMove);
+
+    int best = -INF_SCORE;
+    uint16_t bestMove = 0;
+    Move quiets[64]; // quiet moves searched so far, penalized on a later cutoff
+    int quietCount = 0;
+    int searched = 0;
+    for (int i = 0; i < moves.size(); ++i)
+    {
+        const Move m = moves.pickNext(i);
+        // prune moves that lose 4 or more points in the exchange on their target square,
+        // but always search at least one move
+        if (best > -INF_SCORE && see(gs, m) <= -4)
+            continue;
+        bool quiet = !m.isCapture() && !m.isPromotion();
+        Undo u;
+        makeMove(gs, m, u);
+        ctx.tt->prefetch(gs.key);
+        int theirKing = findKingSquare(gs, !whiteTurn);
+        bool givesCheck = theirKing != -1 && isSquareAttacked(gs, theirKing, whiteTurn);
+        int newDepth = depth - 1 + (ctx.features->checkExtensions && givesCheck ? 1 : 0);
+
+        int val;
+        if (searched == 0)
+            val = -negamax(ctx, gs, !whiteTurn, newDepth, ply + 1, -beta, -alpha);
+        else
+        {
+            // late quiet moves are searched shallower, less so on the PV or with good history
+            int r = 0;
+            if (ctx.features->lmr && quiet && !inCheck && !givesCheck && depth >= 3 && searched >= 3)
+            {
+                r = lmrReductions[std::min(depth, 63)][std::min(searched, 63)];
+                r -= ctx.history[us][m.from()][m.to()] / (HISTORY_MAX / 2);
+                if (pvNode)
+                    --r;
+                r = std::max(0, std::min(r, newDepth - 1));
+            }
+            if (ctx.features->pvs)
+            {
+                // zero window around alpha; re-search at full depth, then with the full window, if it beats alpha
+                val = -negamax(ctx, gs, !whiteTurn, newDepth - r, ply + 1, -alpha - 1, -alpha);
+                if (r > 0 && val > alpha)
+                    val = -negamax(ctx, gs, !whiteTurn, newDepth, ply + 1, -alpha - 1, -alpha);
+                if (val > alpha && val < beta)
+                    val = -negamax(ctx, gs, !whiteTurn, newDepth, ply + 1, -beta, -alpha);
+            }
+            else
+            {
+                val = -negamax(ctx, gs, !whiteTurn, newDepth - r, ply + 1, -beta, -alpha);
+                if (r > 0 && val > alpha)
+                    val = -negamax(ctx, gs, !whiteTurn, newDepth, ply + 1, -beta, -alpha);
+            }
+        }
+        unmakeMove(gs, m, u);
+        if (ctx.stopped)
+            return 0;
+        ++searched;
+        if (val > best)
+        {
+            best = val;
+            bestMove = m.data;
+            if (val > alpha)
+                updatePv(ctx, ply, m);
+        }
+        if (best > alpha)
+            alpha = best;
+        if (alpha >= beta)
+        {
+            if (quiet)
+                updateQuietStats(ctx, us, ply, depth, m, quiets, quietCount);
+            break;
+        }
+        if (quiet && quietCount < 64)
+            quiets[quietCount++] = m;
+    }
+
+    Bound bound = best >= beta ? BOUND_LOWER : best > alphaOrig ? BOUND_EXACT : BOUND_UPPER;
+    ctx.tt->store(gs.key, depth, scoreToTT(best, ply), bound, bestMove);
+    return best;
+}
+
+const int ASPIRATION_WINDOW = 25; // initial half-width in centipawns
+
+// "cp <centipawns>" or "mate <moves>" (negative when the side to move gets mated)
+std::string scoreString(int score)
+{
+    if (std::abs(score) >= MATE_BOUND)
+    {
+        int plies = MATE_SCORE - std::abs(score);
+        int moves = (plies + 1) / 2;
+        return "mate " + std::to_string(score > 0 ? moves : -moves);
+    }
+    return "cp " + std::to_string(score);
+}
+
+// One report per finished iteration: depth, score, nodes, speed, hash usage and the expected line
+void printIterationInfo(const SearchResult &r, uint64_t nodes, int64_t elapsedMs, int hashfull)
+{
+    std::ostringstream line;
+    line << "info depth " << r.depth << " score " << scoreString(r.score) << " nodes " << nodes
+         << " nps " << (uint64_t)(nodes * 1000.0 / std::max<int64_t>(elapsedMs, 1)) << " hashfull " << hashfull
+         << " time " << elapsedMs << " pv";
+    for (const Move &m : r.pv)
+        line << ' ' << moveString(m);
+    line << '\n';
+    std::cout << line.str() << std::flush; // one write, so lines from other threads cannot interleave
+}
+
+// Number of search threads used by searchBestMove (Lazy SMP); set from --threads
+int searchThreads = 1;
+
+// Iterative deepening on one thread: search depth 1, 2, 3, ... until a limit is hit and
+// return the best move of the last iteration that finished. Helper threads (threadId > 0)
+// skip some depths and rotate the root move order so that they fill the shared hash table
+// with different parts of the tree than the main thread.
+SearchResult iterativeDeepening(SearchContext &ctx, GameState gs, bool whiteTurn, MoveList candidates, int threadId)
+{
+    static const int skipSize[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+    static const int skipPhase[] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+    SearchResult result;
+    result.bestMove = candidates[0];
+    gs.accumulator = nullptr;
+    if (nnueEnabled && ctx.features->nnue)
+    {
+        // root at slot 0; makeMove steps one slot up per ply and the search stops before MAX_PLY
+        ctx.accumulators.resize(MAX_PLY);
+        gs.accumulator = ctx.accumulators.data();
+        syncBitboards(gs, whiteTurn);
+    }
+    if (threadId > 0 && candidates.size() > 2)
+        std::rotate(candidates.begin() + 1, candidates.begin() + 1 + threadId % (candidates.size() - 1), candidates.end());
+
+    for (int depth = 1; depth <= ctx.limits.depth; ++depth)
+    {
+        if (threadId > 0 && depth > 1)
+        {
+            int i = (threadId - 1) % 20;
+            if (((depth + skipPhase[i]) / skipSize[i]) % 2)
+                continue;
+        }
+
+        // previous iteration's best move (or the one remembered from an earlier search) goes first
+        TTEntry e;
+        if (ctx.tt->probe(gs.key, e))
+            orderHashMoveFirst(candidates, e.move());
+
+        // aspiration window around the previous score, widened on each fail low/high
+        int delta = ASPIRATION_WINDOW;
+        int alpha = -INF_SCORE, beta = INF_SCORE;
+        if (depth >= 4 && std::abs(result.score) < MATE_BOUND)
+        {
+            alpha = result.score - delta;
+            beta = result.score + delta;
+        }
+        int best;
+        Move iterationBest;
+        while (true)
+        {
+            const int windowAlpha = alpha;
+            best = -INF_SCORE;
+            iterationBest = candidates[0];
+            ctx.pvLength[0] = 0;
+            for (int i = 0; i < candidates.size(); ++i)
+            {
+                const Move m = candidates[i];
+                Undo u;
+                makeMove(gs, m, u);
+                ctx.tt->prefetch(gs.key);
+                int val;
+                if (i == 0 || !ctx.features->pvs)
+                    val = -negamax(ctx, gs, !whiteTurn, depth - 1, 1, -beta, -alpha);
+                else
+                {
+                    // only a move that beats the best so far is worth an exact score
+                    val = -negamax(ctx, gs, !whiteTurn, depth - 1, 1, -alpha - 1, -alpha);
+                    if (val > alpha && val < beta && !ctx.stopped)
+                        val = -negamax(ctx, gs, !whiteTurn, depth - 1, 1, -beta, -alpha);
                 }
-                // en passant
-                if (gs.enPassant == i + 7)
-                    addMove(moves, i, i + 7, true);
+                unmakeMove(gs, m, u);
+                if (ctx.stopped)
+                    break;
+                if (val > best)
+                {
+                    best = val;
+                    iterationBest = m;
+                }
+                if (val > alpha)
+                {
+                    alpha = val;
+                    updatePv(ctx, 0, m);
+                    if (alpha >= beta)
+                        break;
+                }
+            }
+            if (ctx.stopped)
+                break;
+            if (best <= windowAlpha)
+                alpha = std::max(windowAlpha - delta, -INF_SCORE); // fail low: open downwards
+            else if (best >= beta)
+                beta = std::min(beta + delta, INF_SCORE); // fail high: open upwards
+            else
+                break;
+            alpha = std::min(alpha, windowAlpha);
+            delta *= 2;
+            if (delta > 1000)
+                alpha = -INF_SCORE, beta = INF_SCORE;
+        }
+        // a partially searched iteration is thrown away
+        if (ctx.stopped)
+            break;
+
+        ctx.tt->store(gs.key, depth, scoreToTT(best, 0), BOUND_EXACT, iterationBest.data);
+        result.bestMove = iterationBest;
+        result.score = best;
+        result.depth = depth;
+        result.pv.assign(ctx.pv[0], ctx.pv[0] + ctx.pvLength[0]);
+        if (ctx.limits.report && threadId == 0)
+            printIterationInfo(result, ctx.nodes, ctx.elapsedMs(), ctx.tt->hashfull());
+
+        // nothing to think about with a single candidate, and no point deepening past a forced mate
+        if (candidates.size() == 1 || std::abs(best) >= MATE_BOUND)
+            break;
+        if (ctx.limits.softMs && !ctx.pondering() && ctx.elapsedMs() >= ctx.limits.softMs)
+            break;
+    }
+    result.nodes = ctx.nodes;
+    return result;
+}
+
+// Search the root with `threads` threads sharing the transposition table `table`.
+// The main thread owns the limits; when it finishes, the helpers are stopped and the
+// final move is chosen by a vote among the threads that completed the deepest iteration.
+SearchResult searchBestMove(const GameState &root, bool whiteTurn, const SearchLimits &limits, TranspositionTable &table, int threads,
+                            const SearchFeatures &features = searchFeatures)
+{
+    std::atomic<bool> stop{false};
+    SearchContext mainCtx;
+    mainCtx.limits = limits;
+    mainCtx.start = std::chrono::steady_clock::now();
+    mainCtx.stop = &stop;
+    mainCtx.tt = &table;
+    mainCtx.features = &features;
+    SearchResult result;
+
+    // single working copy; everything below makes and unmakes moves on it
+    GameState gs = root;
+    MoveList moves;
+    generateLegalMoves(gs, whiteTurn, moves);
+    if (moves.empty())
+        return result;
+    // The tables ignore the 50-move rule: a win they report may take longer than the halfmove
+    // clock allows, and the root then plays for it anyway instead of searching.
+    int wdl, tbPliesToMate;
+    if (popCount(occupied(gs)) <= tbMaxMen && tablebaseRootMove(gs, whiteTurn, moves, result.bestMove, wdl, tbPliesToMate))
+    {
+        result.score = wdl * (MATE_SCORE - tbPliesToMate);
+        result.pv.push_back(result.bestMove);
+        // the best reply by the tables as well, so UCI has a move to ponder on
+        Undo u;
+        makeMove(gs, result.bestMove, u);
+        MoveList replies;
+        generateLegalMoves(gs, !whiteTurn, replies);
+        Move reply;
+        int replyWdl, replyPlies;
+        if (!replies.empty() && tablebaseRootMove(gs, !whiteTurn, replies, reply, replyWdl, replyPlies))
+            result.pv.push_back(reply);
+        unmakeMove(gs, result.bestMove, u);
+        result.elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - mainCtx.start).count();
+        if (limits.report)
+            printIterationInfo(result, 0, result.elapsedMs, table.hashfull());
+        return result;
+    }
+    table.newSearch();
+
+    // order moves once by MVV-LVA and the static quiet bonus; iterations only move the
+    // previous best move to the front
+    scoreMoves(mainCtx, gs, moves, 0, 0);
+    for (int i = 0; i < moves.size(); ++i)
+        moves.pickNext(i);
+    // avoid immediate large material loss: threshold is material points (side-perspective).
+    // The filter does not depend on depth, so it runs once for all iterations and threads.
+    const int materialLossThreshold = -4; // disallow moves that immediately lose >= 4 points
+    MoveList candidates;
+    for (auto &m : moves)
+        if (see(gs, m) > materialLossThreshold)
+            candidates.push(m);
+    // if we skipped all moves, allow them (no legal safe move)
+    if (candidates.empty())
+        candidates = moves;
+
+    threads = std::max(1, threads);
+    std::vector<SearchContext> helperCtx(threads - 1);
+    std::vector<SearchResult> results(threads);
+    std::vector<std::thread> helpers;
+    for (int t = 1; t < threads; ++t)
+    {
+        SearchContext &ctx = helperCtx[t - 1];
+        ctx.limits.depth = limits.depth; // helpers only stop on depth or the shared flag
+        ctx.start = mainCtx.start;
+        ctx.stop = &stop;
+        ctx.tt = &table;
+        ctx.features = &features;
+        helpers.emplace_back([&, t]
+                             { results[t] = iterativeDeepening(helperCtx[t - 1], gs, whiteTurn, candidates, t); });
+    }
+    results[0] = iterativeDeepening(mainCtx, gs, whiteTurn, candidates, 0);
+    stop = true;
+    for (auto &h : helpers)
+        h.join();
+
+    // deepest result wins; threads that completed that same depth vote on the move, weighted by score
+    int maxDepth = 0;
+    for (auto &r : results)
+        maxDepth = std::max(maxDepth, r.depth);
+    int minScore = INF_SCORE;
+    for (auto &r : results)
+        if (r.depth == maxDepth)
+            minScore = std::min(minScore, r.score);
+    std::vector<std::pair<uint16_t, int64_t>> votes;
+    for (auto &r : results)
+    {
+        if (r.depth != maxDepth)
+            continue;
+        int64_t weight = std::min(r.score - minScore, 2000) + 20;
+        uint16_t pm = r.bestMove.data;
+        auto it = std::find_if(votes.begin(), votes.end(), [&](const std::pair<uint16_t, int64_t> &v)
+                               { return v.first == pm; });
+        if (it == votes.end())
+            votes.push_back({pm, weight});
+        else
+            it->second += weight;
+    }
+    // ties go to the earliest thread (the main thread when it reached that depth)
+    result = results[0];
+    int64_t winnerVotes = -1;
+    for (auto &r : results)
+    {
+        if (r.depth != maxDepth)
+            continue;
+        for (auto &v : votes)
+            if (v.first == r.bestMove.data && v.second > winnerVotes)
+            {
+                winnerVotes = v.second;
+                result = r;
+            }
+    }
+
+    result.nodes = 0;
+    for (auto &r : results)
+        result.nodes += r.nodes;
+    result.elapsedMs = mainCtx.elapsedMs();
+    return result;
+}
+
+// The engine's own search: global hash table and --threads
+SearchResult searchBestMove(const GameState &root, bool whiteTurn, const SearchLimits &limits)
+{
+    return searchBestMove(root, whiteTurn, limits, tt, searchThreads);
+}
+
+// Standard starting position, white to move
+GameState initialPosition()
+{
+    Board board{};
+    for (int i = 0; i < 64; i++)
+        board[i] = '.';
+    for (int i = 0; i < 8; i++)
+    {
+        board[1 * 8 + i] = 'P';
+        board[6 * 8 + i] = 'p';
+        if (i == 0 || i == 7)
+        {
+            board[0 * 8 + i] = 'R';
+            board[7 * 8 + i] = 'r';
+        }
+        else if (i == 1 || i == 6)
+        {
+            board[0 * 8 + i] = 'N';
+            board[7 * 8 + i] = 'n';
+        }
+        else if (i == 2 || i == 5)
+        {
+            board[0 * 8 + i] = 'B';
+            board[7 * 8 + i] = 'b';
+        }
+        else if (i == 3)
+        {
+            board[0 * 8 + i] = 'Q';
+            board[7 * 8 + i] = 'q';
+        }
+        else if (i == 4)
+        {
+            board[0 * 8 + i] = 'K';
+            board[7 * 8 + i] = 'k';
+        }
+    }
+
+    GameState gs;
+    gs.board = board;
+    syncBitboards(gs, true);
+    return gs;
+}
+
+// Set up `gs` from a FEN string. Returns false (leaving gs unspecified) if the FEN is malformed.
+bool parseFen(const std::string &fen, GameState &gs, bool &whiteTurn)
+{
+    std::istringstream in(fen);
+    std::string placement, side, castling = "-", ep = "-";
+    int halfmove = 0, fullmove = 1;
+    if (!(in >> placement >> side))
+        return false;
+    in >> castling >> ep >> halfmove >> fullmove;
+
+    gs = GameState();
+    gs.board.fill('.');
+    int rank = 7, file = 0;
+    for (char c : placement)
+    {
+        if (c == '/')
+        {
+            if (file != 8 || rank == 0)
+                return false;
+            --rank;
+            file = 0;
+        }
+        else if (c >= '1' && c <= '8')
+            file += c - '0';
+        else if (pieceTypeOf(c) != NO_PIECE_TYPE && file < 8)
+            gs.board[rank * 8 + file++] = c;
+        else
+            return false;
+        if (file > 8)
+            return false;
+    }
+    if (rank != 0 || file != 8)
+        return false;
+    if (side != "w" && side != "b")
+        return false;
+    whiteTurn = side == "w";
+
+    // A right only stands if its king and rook are still on their home squares;
+    // sloppy FENs otherwise let makeMove conjure a rook out of nothing
+    const Board &b = gs.board;
+    gs.whiteCastleK = castling.find('K') != std::string::npos && b[4] == 'K' && b[7] == 'R';
+    gs.whiteCastleQ = castling.find('Q') != std::string::npos && b[4] == 'K' && b[0] == 'R';
+    gs.blackCastleK = castling.find('k') != std::string::npos && b[60] == 'k' && b[63] == 'r';
+    gs.blackCastleQ = castling.find('q') != std::string::npos && b[60] == 'k' && b[56] == 'r';
+    gs.enPassant = -1;
+    if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && (ep[1] == '3' || ep[1] == '6'))
+        gs.enPassant = (ep[1] - '1') * 8 + (ep[0] - 'a');
+    gs.halfmoveClock = halfmove;
+    gs.fullmoveNumber = std::max(1, fullmove);
+    syncBitboards(gs, whiteTurn);
+    return popCount(gs.pieces[WHITE][KING]) == 1 && popCount(gs.pieces[BLACK][KING]) == 1;
+}
+
+// FEN string for `gs` with `whiteTurn` to move
+std::string toFen(const GameState &gs, bool whiteTurn)
+{
+    std::string fen;
+    for (int rank = 7; rank >= 0; --rank)
+    {
+        int empty = 0;
+        for (int file = 0; file < 8; ++file)
+        {
+            char c = gs.board[rank * 8 + file];
+            if (c == '.')
+            {
+                ++empty;
+                continue;
+            }
+            if (empty)
+                fen.push_back('0' + empty);
+            empty = 0;
+            fen.push_back(c);
+        }
+        if (empty)
+            fen.push_back('0' + empty);
+        if (rank)
+            fen.push_back('/');
+    }
+    fen += whiteTurn ? " w " : " b ";
+    std::string castling;
+    if (gs.whiteCastleK)
+        castling.push_back('K');
+    if (gs.whiteCastleQ)
+        castling.push_back('Q');
+    if (gs.blackCastleK)
+        castling.push_back('k');
+    if (gs.blackCastleQ)
+        castling.push_back('q');
+    fen += castling.empty() ? "-" : castling;
+    fen += ' ';
+    fen += gs.enPassant >= 0 ? squareName(gs.enPassant) : "-";
+    fen += ' ' + std::to_string(gs.halfmoveClock) + ' ' + std::to_string(gs.fullmoveNumber);
+    return fen;
+}
+
+// --- Perft: move generator validation ---
+// Optional hash of subtree counts, keyed by position and remaining depth
+struct PerftEntry
+{
+    uint64_t key;
+    uint64_t nodes;
+    int depth;
+};
+std::vector<PerftEntry> perftTable;
+
+uint64_t perft(GameState &gs, bool whiteTurn, int depth)
+{
+    // bulk counting: the last ply is just the number of legal moves, no list needed
+    if (depth <= 1)
+        return depth == 1 ? countLegalMoves(gs, whiteTurn) : 1;
+
+    PerftEntry *entry = nullptr;
+    if (!perftTable.empty())
+    {
+        entry = &perftTable[gs.key & (perftTable.size() - 1)];
+        if (entry->key == gs.key && entry->depth == depth)
+            return entry->nodes;
+    }
+
+    MoveList moves;
+    generateLegalMoves(gs, whiteTurn, moves);
+    uint64_t nodes = 0;
+    for (auto &m : moves)
+    {
+        Undo u;
+        makeMove(gs, m, u);
+        nodes += perft(gs, !whiteTurn, depth - 1);
+        unmakeMove(gs, m, u);
+    }
+    if (entry)
+        *entry = {gs.key, nodes, depth};
+    return nodes;
+}
+
+void resizePerftTable(size_t mb)
+{
+    perftTable.clear();
+    if (!mb)
+        return;
+    size_t count = 1;
+    while (count * 2 * sizeof(PerftEntry) <= mb * 1024 * 1024)
+        count *= 2;
+    perftTable.assign(count, PerftEntry{0, 0, -1});
+}
+
+// Perft with per-root-move subtotals ("divide")
+uint64_t perftDivide(GameState &gs, bool whiteTurn, int depth)
+{
+    auto start = std::chrono::steady_clock::now();
+    MoveList moves;
+    generateLegalMoves(gs, whiteTurn, moves);
+    uint64_t total = 0;
+    for (auto &m : moves)
+    {
+        Undo u;
+        makeMove(gs, m, u);
+        uint64_t n = depth > 1 ? perft(gs, !whiteTurn, depth - 1) : 1;
+        unmakeMove(gs, m, u);
+        std::cout << moveString(m) << ": " << n << "\n";
+        total += n;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\nMoves: " << moves.size() << "  Nodes: " << total << "  Time: " << (int64_t)(secs * 1000)
+              << " ms  NPS: " << (uint64_t)(total / std::max(secs, 1e-6)) << "\n";
+    return total;
+}
+
+struct PerftCase
+{
+    const char *name;
+    const char *fen;
+    int depth;
+    uint64_t nodes;
+};
+
+// Reference counts from the usual perft collections (start position, Kiwipete, and
+// positions targeting en passant pins, castling through/into check and promotions),
+// plus a FEN claiming castling rights its king can no longer use
+const PerftCase perftSuite[] = {
+    {"startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+    {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624},
+    {"position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},
+    {"position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+    {"position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+    {"illegal ep move #1", "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888},
+    {"illegal ep move #2", "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", 6, 1015133},
+    {"ep capture checks opponent", "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},
+    {"short castling gives check", "5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},
+    {"long castling gives check", "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},
+    {"castle rights", "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},
+    {"castling prevented", "r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},
+    {"promote out of check", "2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001},
+    {"discovered check", "8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", 5, 1004658},
+    {"promote to give check", "4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},
+    {"under promote to give check", "8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},
+    {"self stalemate", "K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},
+    {"stalemate and checkmate #1", "8/k1P5/8/1K6/8/8/8/8 w - - 0 1", 7, 567584},
+    {"stalemate and checkmate #2", "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527},
+    {"stray castling rights", "r3k2r/8/8/8/8/8/8/R4K1R w KQkq - 0 1", 4, 261945},
+};
+
+// Run every suite position; returns true if all counts match
+bool runPerftSuite()
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t totalNodes = 0;
+    int failures = 0;
+    for (const PerftCase &pc : perftSuite)
+    {
+        GameState gs;
+        bool whiteTurn;
+        if (!parseFen(pc.fen, gs, whiteTurn))
+        {
+            std::cout << pc.name << ": bad FEN\n";
+            ++failures;
+            continue;
+        }
+        uint64_t n = perft(gs, whiteTurn, pc.depth);
+        totalNodes += n;
+        bool ok = n == pc.nodes;
+        failures += !ok;
+        std::cout << (ok ? "ok    " : "FAIL  ") << pc.name << " depth " << pc.depth << ": " << n;
+        if (!ok)
+            std::cout << " (expected " << pc.nodes << ")";
+        std::cout << "\n";
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "\n"
+              << (failures ? "FAILED " : "All passed ") << "(" << failures << " failures)  Nodes: " << totalNodes
+              << "  Time: " << (int64_t)(secs * 1000) << " ms  NPS: " << (uint64_t)(totalNodes / std::max(secs, 1e-6)) << "\n";
+    return failures == 0;
+}
+
+struct TbCase
+{
+    const char *name;
+    const char *fen;
+    int wdl, plies;
+};
+
+// Positions whose result hangs on an en passant reply to a double step
+const TbCase tbSuite[] = {
+    {"g2-g4 hxg3 e.p. draws", "8/8/8/8/7p/7K/6P1/7k w - - 0 1", 0, 0},
+    {"a2-a4 bxa3 e.p. wins for black", "8/8/8/8/1p6/8/Pk5K/8 w - - 0 1", -1, 26},
+};
+
+// Probe every check position in the loaded tables; returns true if all results match
+bool runTablebaseChecks()
+{
+    int failures = 0;
+    for (const TbCase &tc : tbSuite)
+    {
+        GameState gs;
+        bool whiteTurn;
+        int wdl = 0, plies = 0;
+        if (!parseFen(tc.fen, gs, whiteTurn) || !probeTablebase(gs, whiteTurn, wdl, plies))
+            continue; // the table is not there
+        bool ok = wdl == tc.wdl && plies == tc.plies;
+        failures += !ok;
+        std::cout << (ok ? "ok    " : "FAIL  ") << tc.name << ": wdl " << wdl << " plies " << plies;
+        if (!ok)
+            std::cout << " (expected wdl " << tc.wdl << " plies " << tc.plies << ")";
+        std::cout << "\n";
+    }
+    return failures == 0;
+}
+
+// --- Bench: fixed-depth search over a fixed position set ---
+// The total node count is a signature of the search: any change to it means the search changed.
+const char *const benchFens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "r2q1rk1/ppp2ppp/2n1bn2/2bpp3/4P3/2PP1NP1/PP1N1PBP/R1BQ1RK1 w - - 0 8",
+    "2r3k1/pp3ppp/4p3/3pP3/3P4/P4N2/1P3PPP/2R3K1 b - - 0 24",
+    "8/5pk1/6p1/8/3R4/6P1/5PK1/1r6 w - - 0 40",
+    "8/8/4kp2/8/5K2/5P2/8/8 w - - 0 60",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+};
+
+void runBench(int depth)
+{
+    int savedThreads = searchThreads;
+    searchThreads = 1; // the signature is only reproducible single-threaded
+    uint64_t totalNodes = 0;
+    int64_t totalMs = 0;
+    for (const char *fen : benchFens)
+    {
+        GameState gs;
+        bool whiteTurn;
+        if (!parseFen(fen, gs, whiteTurn))
+            continue;
+        tt.clear();
+        SearchLimits limits;
+        limits.depth = depth;
+        SearchResult r = searchBestMove(gs, whiteTurn, limits);
+        totalNodes += r.nodes;
+        totalMs += r.elapsedMs;
+        std::cout << fen << "\n  bestmove " << moveString(r.bestMove) << "  score " << r.score << "  nodes " << r.nodes << "\n";
+    }
+    searchThreads = savedThreads;
+    std::cout << "\nTotal time (ms) : " << totalMs << "\nNodes searched  : " << totalNodes
+              << "\nNodes/second    : " << (uint64_t)(totalNodes * 1000.0 / std::max<int64_t>(totalMs, 1)) << "\n";
+}
+
+// --- EPD test suites ---
+// One EPD record: position plus the best-move (bm) / avoid-move (am) operations to check
+struct EpdCase
+{
+    std::string id;
+    std::string fen;
+    std::vector<std::string> bestMoves;  // SAN as written in the file
+    std::vector<std::string> avoidMoves; // SAN as written in the file
+};
+
+// Parse "<placement> <side> <castling> <ep> op1 args; op2 args; ..." (hmvc/fmvn default to 0 1)
+bool parseEpdLine(const std::string &line, EpdCase &ec)
+{
+    std::istringstream in(line);
+    std::string f[4];
+    if (!(in >> f[0] >> f[1] >> f[2] >> f[3]))
+        return false;
+    ec.fen = f[0] + " " + f[1] + " " + f[2] + " " + f[3] + " 0 1";
+    std::string ops;
+    std::getline(in, ops);
+    std::istringstream opsIn(ops);
+    std::string op;
+    while (std::getline(opsIn, op, ';'))
+    {
+        std::istringstream opIn(op);
+        std::string code, arg;
+        if (!(opIn >> code))
+            continue;
+        while (opIn >> arg)
+        {
+            if (code == "bm")
+                ec.bestMoves.push_back(arg);
+            else if (code == "am")
+                ec.avoidMoves.push_back(arg);
+            else if (code == "id")
+            {
+                std::getline(opIn, ec.id);
+                ec.id = arg + ec.id;
+                ec.id.erase(std::remove(ec.id.begin(), ec.id.end(), '"'), ec.id.end());
+                break;
             }
-            if (i % 8 != 7)
+            else if (code == "hmvc" || code == "fmvn")
             {
-                if (i + 9 < 64 && isBlack(board[i + 9]))
-                {
-                    if (i + 9 >= 56)
-                    {
-                        addMove(moves, i, i + 9, true, 'Q');
-                        addMove(moves, i, i + 9, true, 'R');
-                        addMove(moves, i, i + 9, true, 'B');
-                        addMove(moves, i, i + 9, true, 'N');
-                    }
-                    else
-                        addMove(moves, i, i + 9, true);
-                }
-                if (gs.enPassant == i + 9)
-                    addMove(moves, i, i + 9, true);
+                // keep the FEN clocks in step with the operations
+                size_t sp = ec.fen.rfind(' ');
+                size_t sp2 = ec.fen.rfind(' ', sp - 1);
+                ec.fen = code == "hmvc" ? ec.fen.substr(0, sp2 + 1) + arg + ec.fen.substr(sp) : ec.fen.substr(0, sp + 1) + arg;
             }
         }
-        else if (!whiteTurn && board[i] == 'p')
+    }
+    return true;
+}
+
+// Search every position of an EPD file on a pool of `workers` threads, each with its own
+// hash table, and report per-position results plus solve rate, nodes and throughput.
+void runEpdSuite(const std::string &path, const SearchLimits &limits, int workers, size_t hashMB)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        std::cout << "Cannot open EPD file " << path << "\n";
+        return;
+    }
+    std::vector<EpdCase> cases;
+    std::string line;
+    while (std::getline(f, line))
+    {
+        EpdCase ec;
+        if (line.empty() || line[0] == '#' || !parseEpdLine(line, ec))
+            continue;
+        if (ec.id.empty())
+            ec.id = "#" + std::to_string(cases.size() + 1);
+        cases.push_back(ec);
+    }
+
+    std::vector<int> solved(cases.size(), 0); // 1 solved, 0 failed, -1 invalid position
+    std::vector<std::string> played(cases.size());
+    std::vector<uint64_t> nodes(cases.size(), 0);
+    std::atomic<size_t> next{0};
+    std::mutex outMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&]()
+    {
+        TranspositionTable table;
+        table.resize(hashMB, false);
+        for (size_t i = next++; i < cases.size(); i = next++)
         {
-            // Forward 1
-            if (i - 8 >= 0 && board[i - 8] == '.')
+            const EpdCase &ec = cases[i];
+            GameState gs;
+            bool whiteTurn;
+            if (!parseFen(ec.fen, gs, whiteTurn))
             {
-                if (i - 8 <= 7)
-                {
-                    addMove(moves, i, i - 8, false, 'q');
-                    addMove(moves, i, i - 8, false, 'r');
-                    addMove(moves, i, i - 8, false, 'b');
-                    addMove(moves, i, i - 8, false, 'n');
-                }
-                else
-                    addMove(moves, i, i - 8);
-                // Forward 2
-                if (i / 8 == 6 && board[i - 16] == '.')
-                    addMove(moves, i, i - 16);
+                solved[i] = -1;
+                continue;
+            }
+            table.clear();
+            SearchResult r = searchBestMove(gs, whiteTurn, limits, table, 1);
+            nodes[i] = r.nodes;
+            bool ok = true;
+            Move m;
+            if (!ec.bestMoves.empty())
+            {
+                ok = false;
+                for (auto &san : ec.bestMoves)
+                    if (parseSan(gs, whiteTurn, san, m) && m.data == r.bestMove.data)
+                        ok = true;
             }
-            // Captures
-            if (i % 8 != 0)
+            for (auto &san : ec.avoidMoves)
+                if (parseSan(gs, whiteTurn, san, m) && m.data == r.bestMove.data)
+                    ok = false;
+            solved[i] = ok ? 1 : 0;
+            played[i] = r.depth ? moveToSan(gs, r.bestMove, whiteTurn) : "(none)";
+
+            std::lock_guard<std::mutex> lock(outMutex);
+            std::cout << (ok ? "ok    " : "FAIL  ") << ec.id << "  played " << played[i] << "  depth " << r.depth
+                      << "  nodes " << r.nodes << "\n";
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, workers); ++t)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int total = 0, ok = 0;
+    uint64_t totalNodes = 0;
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        if (solved[i] < 0)
+        {
+            std::cout << "invalid position skipped: " << cases[i].id << "\n";
+            continue;
+        }
+        ++total;
+        ok += solved[i];
+        totalNodes += nodes[i];
+    }
+    std::cout << "\nSolved: " << ok << " / " << total << " (" << (total ? 100.0 * ok / total : 0.0) << "%)"
+              << "\nNodes: " << totalNodes << "\nTime: " << (int64_t)(secs * 1000) << " ms"
+              << "\nNPS: " << (uint64_t)(totalNodes / std::max(secs, 1e-6))
+              << "\nPositions/second: " << total / std::max(secs, 1e-6) << "\n";
+}
+
+// Lazy SMP scaling: time-to-depth and NPS of a fixed-depth search over the bench
+// positions for 1, 2, 4, 8 and 16 threads
+void runSmpBench(int depth)
+{
+    const int threadCounts[] = {1, 2, 4, 8, 16};
+    double baseMs = 0;
+    std::cout << "threads  time(ms)  nodes  nps  speedup\n";
+    for (int threads : threadCounts)
+    {
+        searchThreads = threads;
+        uint64_t nodes = 0;
+        int64_t elapsedMs = 0;
+        for (const char *fen : benchFens)
+        {
+            GameState gs;
+            bool whiteTurn;
+            if (!parseFen(fen, gs, whiteTurn))
+                continue;
+            tt.clear();
+            SearchLimits limits;
+            limits.depth = depth;
+            SearchResult r = searchBestMove(gs, whiteTurn, limits);
+            nodes += r.nodes;
+            elapsedMs += r.elapsedMs;
+        }
+        double ms = (double)std::max<int64_t>(elapsedMs, 1);
+        if (threads == 1)
+            baseMs = ms;
+        std::cout << threads << "  " << elapsedMs << "  " << nodes << "  "
+                  << (uint64_t)(nodes * 1000.0 / ms) << "  " << baseMs / ms << "\n";
+    }
+}
+
+// --- Game records ---
+// How often the current position (the last key) occurred since the last irreversible move;
+// only every second position has the same side to move
+int repetitionCount(const std::vector<uint64_t> &keyHistory, int halfmoveClock)
+{
+    int count = 1;
+    uint64_t key = keyHistory.back();
+    for (int back = 2; back <= halfmoveClock && back < (int)keyHistory.size(); back += 2)
+        if (keyHistory[keyHistory.size() - 1 - back] == key)
+            ++count;
+    return count;
+}
+
+// No pawns, rooks or queens and at most one minor piece per side: nobody can mate
+bool insufficientMaterial(const GameState &gs)
+{
+    for (int c = 0; c < 2; ++c)
+    {
+        if (gs.pieces[c][PAWN] | gs.pieces[c][ROOK] | gs.pieces[c][QUEEN])
+            return false;
+        if (popCount(gs.pieces[c][KNIGHT] | gs.pieces[c][BISHOP]) > 1)
+            return false;
+    }
+    return true;
+}
+
+// One game in PGN. `setUp` adds the SetUp/FEN tags for games that do not start from the
+// initial position; such a game may begin with black and at any move number.
+void writePgn(std::ostream &pf, const std::string &event, const std::string &round, const std::string &white,
+              const std::string &black, const std::string &result, const GameState &startGs, bool startWhite,
+              bool setUp, const std::vector<std::string> &sanMoves)
+{
+    std::time_t t = std::time(nullptr);
+    std::tm tm = *std::localtime(&t);
+    char datebuf[32];
+    std::snprintf(datebuf, sizeof(datebuf), "%04d.%02d.%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+    pf << "[Event \"" << event << "\"]\n";
+    pf << "[Site \"Local\"]\n";
+    pf << "[Date \"" << datebuf << "\"]\n";
+    pf << "[Round \"" << round << "\"]\n";
+    pf << "[White \"" << white << "\"]\n";
+    pf << "[Black \"" << black << "\"]\n";
+    pf << "[Result \"" << result << "\"]\n";
+    if (setUp)
+    {
+        pf << "[SetUp \"1\"]\n";
+        pf << "[FEN \"" << toFen(startGs, startWhite) << "\"]\n";
+    }
+    pf << "\n";
+
+    int moveNumber = startGs.fullmoveNumber;
+    bool whiteMove = startWhite;
+    for (size_t i = 0; i < sanMoves.size(); ++i)
+    {
+        if (whiteMove)
+            pf << moveNumber << ". ";
+        else if (i == 0)
+            pf << moveNumber << "... ";
+        pf << sanMoves[i] << ' ';
+        if (!whiteMove)
+            ++moveNumber;
+        whiteMove = !whiteMove;
+    }
+    pf << " " << result << "\n";
+}
+
+// --- PGN databases ---
+// One game of a database: the tag pairs, the start position and the moves, each with the
+// key of the position it was played in
+struct PgnGame
+{
+    std::vector<std::pair<std::string, std::string>> tags;
+    std::string result = "*";
+    GameState start;
+    bool startWhite = true;
+    std::vector<Move> moves;
+    std::vector<uint64_t> keys;
+
+    const std::string *tag(const std::string &name) const
+    {
+        for (const auto &t : tags)
+            if (t.first == name)
+                return &t.second;
+        return nullptr;
+    }
+};
+
+// Parse and replay one game, [begin, end) starting at its first tag. Every move is checked
+// against the legal moves, so a game that returns true is a sequence of legal positions.
+// Text the parser would have to skip (a stray tag line, anything after the result) rejects it.
+bool parsePgnGame(const char *begin, const char *end, PgnGame &game)
+{
+    game.tags.clear();
+    game.moves.clear();
+    game.keys.clear();
+    game.result = "*";
+    const char *p = begin;
+
+    // tag pairs: [Name "value"]
+    for (;;)
+    {
+        while (p < end && std::isspace((unsigned char)*p))
+            ++p;
+        if (p >= end || *p != '[')
+            break;
+        const char *close = (const char *)std::memchr(p, '\n', end - p);
+        const char *lineEnd = close ? close : end;
+        const char *name = p + 1;
+        const char *nameEnd = name;
+        while (nameEnd < lineEnd && !std::isspace((unsigned char)*nameEnd))
+            ++nameEnd;
+        const char *q1 = (const char *)std::memchr(nameEnd, '"', lineEnd - nameEnd);
+        const char *q2 = q1 ? (const char *)std::memchr(q1 + 1, '"', lineEnd - q1 - 1) : nullptr;
+        if (q2)
+            game.tags.emplace_back(std::string(name, nameEnd), std::string(q1 + 1, q2));
+        p = lineEnd;
+    }
+
+    game.start = initialPosition();
+    game.startWhite = true;
+    const std::string *fen = game.tag("FEN");
+    if (fen && !parseFen(*fen, game.start, game.startWhite))
+        return false;
+    GameState gs = game.start;
+    bool whiteTurn = game.startWhite;
+
+    // movetext: comments, variations, NAGs and move numbers are skipped
+    while (p < end)
+    {
+        char c = *p;
+        if (std::isspace((unsigned char)c))
+            ++p;
+        else if (c == '{')
+        {
+            const char *close = (const char *)std::memchr(p, '}', end - p);
+            p = close ? close + 1 : end;
+        }
+        else if (c == ';' || (c == '%' && (p == begin || p[-1] == '\n')))
+        {
+            const char *nl = (const char *)std::memchr(p, '\n', end - p);
+            p = nl ? nl + 1 : end;
+        }
+        else if (c == '(')
+        {
+            int depth = 0;
+            for (; p < end; ++p)
             {
-                if (i - 9 >= 0 && isWhite(board[i - 9]))
+                if (*p == '{')
                 {
-                    if (i - 9 <= 7)
-                    {
-                        addMove(moves, i, i - 9, true, 'q');
-                        addMove(moves, i, i - 9, true, 'r');
-                        addMove(moves, i, i - 9, true, 'b');
-                        addMove(moves, i, i - 9, true, 'n');
-                    }
-                    else
-                        addMove(moves, i, i - 9, true);
+                    const char *close = (const char *)std::memchr(p, '}', end - p);
+                    p = close ? close : end - 1;
+                }
+                else if (*p == '(')
+                    ++depth;
+                else if (*p == ')' && --depth == 0)
+                {
+                    ++p;
+                    break;
                 }
-                if (gs.enPassant == i - 9)
-                    addMove(moves, i, i - 9, true);
             }
-            if (i % 8 != 7)
+        }
+        else if (c == '$' || c == ')')
+        {
+            ++p;
+            while (p < end && std::isdigit((unsigned char)*p))
+                ++p;
+        }
+        else if (c == '[')
+            return false; // a tag line that cannot open a game: the text would be lost
+        else
+        {
+            const char *tok = p;
+            while (p < end && !std::isspace((unsigned char)*p) && !std::strchr("{}();", *p))
+                ++p;
+            // move number ("12." or "12...") possibly glued to the move, or the game result
+            std::string token(tok, p);
+            if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*")
+            {
+                game.result = token;
+                // whatever follows up to the next game is skipped, so the game is rejected
+                while (p < end && std::isspace((unsigned char)*p))
+                    ++p;
+                if (p < end)
+                    return false;
+                break;
+            }
+            const char *san = tok;
+            while (san < p && std::isdigit((unsigned char)*san))
+                ++san;
+            if (san > tok)
+                while (san < p && *san == '.')
+                    ++san;
+            if (san == p)
+                continue;
+            Move m;
+            if (!parseSan(gs, whiteTurn, san, p - san, m))
+                return false;
+            game.keys.push_back(gs.key);
+            game.moves.push_back(m);
+            Undo u;
+            makeMove(gs, m, u);
+            whiteTurn = !whiteTurn;
+        }
+    }
+    const std::string *result = game.tag("Result");
+    if (game.result == "*" && result)
+        game.result = *result;
+    return true;
+}
+
+// True if the tag line at `b` opens a game: it follows the start of the file, a blank line
+// or the previous game's result token. Tag lines inside one header never do, and the test
+// only looks backwards, so every block worker cuts the file at the same places.
+bool startsPgnGame(const char *b, const char *begin)
+{
+    const char *q = b;
+    int newlines = 0;
+    while (q > begin && std::isspace((unsigned char)q[-1]))
+        newlines += *--q == '\n';
+    if (q == begin || newlines >= 2)
+        return true;
+    const char *tok = q;
+    while (tok > begin && !std::isspace((unsigned char)tok[-1]))
+        --tok;
+    std::string token(tok, q);
+    return token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*";
+}
+
+// Start of the first game at or after `p`: a tag line that opens a game
+const char *nextPgnGame(const char *p, const char *begin, const char *end)
+{
+    while (p < end)
+    {
+        const char *b = (const char *)std::memchr(p, '[', end - p);
+        if (!b)
+            return end;
+        if ((b == begin || b[-1] == '\n') && startsPgnGame(b, begin))
+            return b;
+        p = b + 1;
+    }
+    return end;
+}
+
+struct PgnStats
+{
+    uint64_t games = 0, errors = 0, positions = 0;
+};
+
+// Parse and replay every game of a mapped database on `threads` threads. The file is cut into
+// 1 MB blocks handed out in order; a block's worker takes the games that start inside it (and
+// reads past its end to finish the last one), so the work needs no index and no copies.
+// `onGame` is called for each legal game, concurrently from the workers (worker id passed).
+PgnStats replayPgnDatabase(const MappedFile &db, int threads,
+                           const std::function<void(int worker, const PgnGame &)> &onGame)
+{
+    const size_t BLOCK = 1 << 20;
+    const char *begin = db.data, *end = db.data + db.size;
+    size_t blocks = (db.size + BLOCK - 1) / BLOCK;
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> games{0}, errors{0}, positions{0};
+    auto worker = [&](int id)
+    {
+        PgnGame game;
+        uint64_t g = 0, e = 0, n = 0;
+        for (size_t b = next++; b < blocks; b = next++)
+        {
+            const char *blockEnd = begin + std::min(db.size, (b + 1) * BLOCK);
+            const char *start = nextPgnGame(begin + b * BLOCK, begin, end);
+            if (b == 0 && std::any_of(begin, start, [](char c) { return !std::isspace((unsigned char)c); }))
+                ++e; // text before the first game
+            while (start < blockEnd)
             {
-                if (i - 7 >= 0 && isWhite(board[i - 7]))
+                const char *stop = nextPgnGame(start + 1, begin, end);
+                if (parsePgnGame(start, stop, game))
                 {
-                    if (i - 7 <= 7)
-                    {
-                        addMove(moves, i, i - 7, true, 'q');
-                        addMove(moves, i, i - 7, true, 'r');
-                        addMove(moves, i, i - 7, true, 'b');
-                        addMove(moves, i, i - 7, true, 'n');
-                    }
-                    else
-                        addMove(moves, i, i - 7, true);
+                    ++g;
+                    n += game.moves.size();
+                    if (onGame)
+                        onGame(id, game);
                 }
-                if (gs.enPassant == i - 7)
-                    addMove(moves, i, i - 7, true);
+                else
+                    ++e;
+                start = stop;
             }
         }
+        games += g;
+        errors += e;
+        positions += n;
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, threads); ++t)
+        pool.emplace_back(worker, t);
+    for (auto &t : pool)
+        t.join();
+    return PgnStats{games, errors, positions};
+}
+
+// --pgn-replay: validate a database and report its results and the replay speed
+void runPgnReplay(const std::string &path, int threads)
+{
+    MappedFile db;
+    if (!db.open(path))
+    {
+        std::cout << "Cannot open " << path << "\n";
+        return;
+    }
+    std::vector<std::array<uint64_t, 4>> results(std::max(1, threads)); // 1-0, 0-1, 1/2-1/2, other
+    auto start = std::chrono::steady_clock::now();
+    PgnStats st = replayPgnDatabase(db, threads, [&](int worker, const PgnGame &game)
+                                    {
+                                        int r = game.result == "1-0" ? 0 : game.result == "0-1" ? 1 : game.result == "1/2-1/2" ? 2 : 3;
+                                        ++results[worker][r];
+                                    });
+    double secs = std::max(1e-9, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    std::array<uint64_t, 4> total{};
+    for (const auto &r : results)
+        for (int i = 0; i < 4; ++i)
+            total[i] += r[i];
+    std::printf("%llu games (%llu rejected), %llu positions in %.2f s: %.0f positions/s, %.1f MB/s\n",
+                (unsigned long long)st.games, (unsigned long long)st.errors, (unsigned long long)st.positions, secs,
+                st.positions / secs, db.size / secs / 1048576.0);
+    std::printf("White wins %llu, black wins %llu, draws %llu, unfinished %llu\n", (unsigned long long)total[0],
+                (unsigned long long)total[1], (unsigned long long)total[2], (unsigned long long)total[3]);
+}
+
+// --- Opening book (optional, --book <file>) ---
+// Binary format, little-endian:
+//   header  8 bytes "CHSBOOK1", uint64 key of the initial position, uint64 entry count
+//   entries 16 bytes each, sorted by key and then move: uint64 key, uint16 move (Move::data),
+//           uint16 weight, uint32 reserved (0)
+// The layout follows Polyglot (one entry per position and move, weights relative within a
+// position), but keys are this engine's Zobrist keys; the header key rejects a book made
+// with other Zobrist numbers. The book is mapped and probed in place by binary search.
+struct BookEntry
+{
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+    uint32_t reserved;
+};
+static_assert(sizeof(BookEntry) == 16, "book entries are 16 bytes on disk");
+
+const char BOOK_MAGIC[8] = {'C', 'H', 'S', 'B', 'O', 'O', 'K', '1'};
+const size_t BOOK_HEADER_SIZE = 24;
+
+struct OpeningBook
+{
+    MappedFile file;
+    const BookEntry *entries = nullptr;
+    size_t count = 0;
+
+    bool loaded() const { return entries != nullptr; }
+
+    bool open(const std::string &path)
+    {
+        entries = nullptr;
+        count = 0;
+        if (!file.open(path) || file.size < BOOK_HEADER_SIZE || std::memcmp(file.data, BOOK_MAGIC, 8) != 0)
+            return false;
+        uint64_t startKey, n;
+        std::memcpy(&startKey, file.data + 8, 8);
+        std::memcpy(&n, file.data + 16, 8);
+        if (startKey != initialPosition().key || file.size != BOOK_HEADER_SIZE + n * sizeof(BookEntry) || n == 0)
+            return false;
+        entries = (const BookEntry *)(file.data + BOOK_HEADER_SIZE);
+        count = (size_t)n;
+        return true;
+    }
+};
+
+OpeningBook book;
+
+// A book move for the position, chosen at random in proportion to the weights, or a null
+// move when the position is not in the book
+Move probeBook(const OpeningBook &b, const GameState &gs, bool whiteTurn, Prng &rng)
+{
+    if (!b.loaded())
+        return Move();
+    const BookEntry *end = b.entries + b.count;
+    const BookEntry *first = std::lower_bound(b.entries, end, gs.key,
+                                              [](const BookEntry &e, uint64_t key) { return e.key < key; });
+    uint32_t total = 0;
+    const BookEntry *last = first;
+    for (; last < end && last->key == gs.key; ++last)
+        total += last->weight;
+    if (total == 0)
+        return Move();
+    uint32_t pick = (uint32_t)(rng.next() % total);
+    Move m;
+    for (const BookEntry *e = first; e < last; ++e)
+    {
+        if (pick < e->weight)
+        {
+            m = Move::fromData(e->move);
+            break;
+        }
+        pick -= e->weight;
+    }
+    // a key collision must not play an illegal move
+    MoveList legal;
+    generateLegalMoves(gs, whiteTurn, legal);
+    for (int i = 0; i < legal.size(); ++i)
+        if (legal[i] == m)
+            return m;
+    return Move();
+}
+
+// Position and move with the points the mover scored (win 2, draw 1, loss 0)
+struct BookSample
+{
+    uint64_t key;
+    uint16_t move;
+    uint32_t points;
+};
+
+// Sort and add up the samples of the same position and move
+void mergeBookSamples(std::vector<BookSample> &samples)
+{
+    std::sort(samples.begin(), samples.end(), [](const BookSample &a, const BookSample &b)
+              { return a.key != b.key ? a.key < b.key : a.move < b.move; });
+    size_t out = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (out && samples[out - 1].key == samples[i].key && samples[out - 1].move == samples[i].move)
+            samples[out - 1].points = (uint32_t)std::min<uint64_t>(0xFFFFFFFFu, (uint64_t)samples[out - 1].points + samples[i].points);
+        else
+            samples[out++] = samples[i];
+    }
+    samples.resize(out);
+}
+
+// Build a book from the first `maxPlies` plies of every finished game in `source` (a PGN file
+// or a directory searched for *.pgn). Moves that never scored are left out.
+bool buildBook(const std::string &source, const std::string &outPath, int maxPlies, int threads)
+{
+    std::vector<std::string> files;
+    std::error_code ec;
+    if (std::filesystem::is_directory(source, ec))
+    {
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(source, ec))
+            if (entry.is_regular_file() && entry.path().extension() == ".pgn")
+                files.push_back(entry.path().string());
+        std::sort(files.begin(), files.end());
+    }
+    else
+        files.push_back(source);
+
+    std::vector<BookSample> samples;
+    uint64_t games = 0;
+    for (const std::string &path : files)
+    {
+        MappedFile db;
+        if (!db.open(path))
+        {
+            std::cout << "Cannot open " << path << "\n";
+            continue;
+        }
+        std::vector<std::vector<BookSample>> perWorker(std::max(1, threads));
+        PgnStats st = replayPgnDatabase(db, threads, [&](int worker, const PgnGame &game)
+                                        {
+            int whitePoints = game.result == "1-0" ? 2 : game.result == "0-1" ? 0 : game.result == "1/2-1/2" ? 1 : -1;
+            if (whitePoints < 0)
+                return;
+            bool white = game.startWhite;
+            for (size_t i = 0; i < game.moves.size() && (int)i < maxPlies; ++i)
+            {
+                perWorker[worker].push_back(BookSample{game.keys[i], game.moves[i].data, (uint32_t)(white ? whitePoints : 2 - whitePoints)});
+                white = !white;
+            } });
+        games += st.games;
+        for (auto &w : perWorker)
+            samples.insert(samples.end(), w.begin(), w.end());
+        mergeBookSamples(samples); // keeps memory proportional to distinct positions, not games
+    }
+
+    // scale the points into 16-bit weights
+    uint32_t maxPoints = 0;
+    for (const BookSample &s : samples)
+        maxPoints = std::max(maxPoints, s.points);
+    std::vector<BookEntry> entries;
+    for (const BookSample &s : samples)
+    {
+        if (s.points == 0)
+            continue;
+        uint64_t w = maxPoints > 0xFFFF ? (uint64_t)s.points * 0xFFFF / maxPoints : s.points;
+        entries.push_back(BookEntry{s.key, s.move, (uint16_t)std::max<uint64_t>(1, w), 0});
+    }
+    if (entries.empty())
+    {
+        std::cout << "No finished games found in " << source << "\n";
+        return false;
+    }
+
+    std::ofstream f(outPath, std::ios::binary);
+    uint64_t startKey = initialPosition().key, n = entries.size();
+    f.write(BOOK_MAGIC, 8);
+    f.write((const char *)&startKey, 8);
+    f.write((const char *)&n, 8);
+    f.write((const char *)entries.data(), entries.size() * sizeof(BookEntry));
+    if (!f)
+    {
+        std::cout << "Cannot write " << outPath << "\n";
+        return false;
+    }
+    std::cout << "Book " << outPath << ": " << entries.size() << " moves from " << games << " games in " << files.size()
+              << " files\n";
+    return true;
+}
+
+// --- Self-play matches ---
+// One side of a match: search limits, search techniques and hash size
+struct EngineConfig
+{
+    std::string name;
+    SearchLimits limits;
+    SearchFeatures features;
+    size_t hashMB = 16;
+};
+
+// Comma separated options on top of `base`, e.g. "depth=8,hash=32,no-lmr":
+// depth=, nodes=, movetime=, hash=, name=, no-pvs, no-null-move, no-lmr, no-check-extensions, no-nnue
+bool parseEngineConfig(const std::string &spec, const SearchLimits &base, EngineConfig &ec)
+{
+    ec.limits = base;
+    ec.name = spec.empty() ? "default" : spec;
+    std::istringstream in(spec);
+    std::string opt;
+    while (std::getline(in, opt, ','))
+    {
+        size_t eq = opt.find('=');
+        std::string key = opt.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : opt.substr(eq + 1);
+        if (key == "depth")
+            ec.limits.depth = std::max(1, std::min(MAX_PLY - 1, std::atoi(value.c_str())));
+        else if (key == "nodes")
+            ec.limits.nodes = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "movetime")
+        {
+            ec.limits.hardMs = std::max(1, std::atoi(value.c_str()));
+            ec.limits.softMs = ec.limits.hardMs / 2;
+        }
+        else if (key == "hash")
+            ec.hashMB = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        else if (key == "name")
+            ec.name = value;
+        else if (key == "no-pvs")
+            ec.features.pvs = false;
+        else if (key == "no-null-move")
+            ec.features.nullMove = false;
+        else if (key == "no-lmr")
+            ec.features.lmr = false;
+        else if (key == "no-check-extensions")
+            ec.features.checkExtensions = false;
+        else if (key == "no-nnue")
+            ec.features.nnue = false;
+        else if (!key.empty())
+        {
+            std::cout << "Unknown engine option " << key << "\n";
+            return false;
+        }
     }
+    ec.limits.report = false;
+    return true;
 }
 
-void generateKnightMoves(const Board &board, int i, bool whiteTurn, std::vector<Move> &moves)
+struct Opening
+{
+    GameState gs;
+    bool whiteTurn;
+};
+
+// One position per line, FEN or EPD (only the first four fields are used)
+bool loadOpenings(const std::string &path, std::vector<Opening> &openings)
 {
-    static const int dfile[] = {1, 2, 2, 1, -1, -2, -2, -1};
-    static const int drank[] = {2, 1, -1, -2, -2, -1, 1, 2};
-    char me = board[i];
-    for (int k = 0; k < 8; ++k)
+    std::ifstream f(path);
+    if (!f)
     {
-        int nf = fileOf(i) + dfile[k], nr = rankOf(i) + drank[k];
-        if (nf < 0 || nf > 7 || nr < 0 || nr > 7)
+        std::cout << "Cannot open openings file " << path << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(f, line))
+    {
+        EpdCase ec;
+        Opening o;
+        if (line.empty() || line[0] == '#' || !parseEpdLine(line, ec) || !parseFen(ec.fen, o.gs, o.whiteTurn))
             continue;
-        int to = nr * 8 + nf;
-        if (board[to] == '.')
-            addMove(moves, i, to);
-        else if (!sameColor(me, board[to]))
-            addMove(moves, i, to, true);
+        openings.push_back(o);
     }
+    return !openings.empty();
 }
 
-void generateSlidingMoves(const Board &board, int i, const std::vector<std::pair<int, int>> &dirs, std::vector<Move> &moves)
+// `count` openings of 8 random plies from the initial position, kept only while material is level
+void randomOpenings(int count, uint64_t seed, std::vector<Opening> &openings)
 {
-    char me = board[i];
-    for (auto [df, dr] : dirs)
+    Prng rng{seed};
+    while ((int)openings.size() < count)
     {
-        int nf = fileOf(i) + df, nr = rankOf(i) + dr;
-        while (nf >= 0 && nf <= 7 && nr >= 0 && nr <= 7)
+        Opening o{initialPosition(), true};
+        bool ok = true;
+        for (int ply = 0; ply < 8 && ok; ++ply)
         {
-            int to = nr * 8 + nf;
-            if (board[to] == '.')
-                addMove(moves, i, to);
+            MoveList legal;
+            generateLegalMoves(o.gs, o.whiteTurn, legal);
+            if (legal.empty())
+                ok = false;
             else
             {
-                if (!sameColor(me, board[to]))
-                    addMove(moves, i, to, true);
-                break;
+                Undo u;
+                makeMove(o.gs, legal[(int)(rng.next() % legal.size())], u);
+                o.whiteTurn = !o.whiteTurn;
             }
-            nf += df;
-            nr += dr;
         }
+        if (ok && materialBalance(o.gs) == 0 && countLegalMoves(o.gs, o.whiteTurn) > 0)
+            openings.push_back(o);
     }
 }
 
-void generateKingMoves(const GameState &gs, int i, std::vector<Move> &moves)
-{
-    const Board &board = gs.board;
-    char me = board[i];
-    bool white = isWhite(me);
-    for (int df = -1; df <= 1; ++df)
-        for (int dr = -1; dr <= 1; ++dr)
-        {
-            if (df == 0 && dr == 0)
-                continue;
-            int nf = fileOf(i) + df, nr = rankOf(i) + dr;
-            if (nf < 0 || nf > 7 || nr < 0 || nr > 7)
-                continue;
-            int to = nr * 8 + nf;
-            if (board[to] == '.')
-                addMove(moves, i, to);
-            else if (!sameColor(me, board[to]))
-                addMove(moves, i, to, true);
-        }
+const int MATCH_MAX_PLIES = 400; // adjudicated as a draw
 
-    // Castling pseudo-legal (squares must be empty and not attacked)
-    if (white && me == 'K' && i == 4)
+// The moves of a match game from `gs` until it ends; returns the PGN result
+std::string playMatchMoves(GameState &gs, bool whiteTurn, const EngineConfig *engines[2], TranspositionTable *tables[2],
+                           std::vector<uint64_t> &keyHistory, GameFeed &feed, std::vector<std::string> &sanMoves,
+                           std::string &termination)
+{
+    for (int ply = 0; ply < MATCH_MAX_PLIES; ++ply)
     {
-        // kingside
-        if (gs.whiteCastleK && board[5] == '.' && board[6] == '.')
+        int side = whiteTurn ? WHITE : BLACK;
+        if (countLegalMoves(gs, whiteTurn) == 0)
         {
-            if (!isSquareAttacked(board, 4, false) && !isSquareAttacked(board, 5, false) && !isSquareAttacked(board, 6, false))
-                addMove(moves, 4, 6, false);
+            int kingSq = findKingSquare(gs, whiteTurn);
+            if (kingSq != -1 && isSquareAttacked(gs, kingSq, !whiteTurn))
+            {
+                termination = "checkmate";
+                return whiteTurn ? "0-1" : "1-0";
+            }
+            termination = "stalemate";
+            return "1/2-1/2";
         }
-        // queenside
-        if (gs.whiteCastleQ && board[3] == '.' && board[2] == '.' && board[1] == '.')
+        SearchResult r = searchBestMove(gs, whiteTurn, engines[side]->limits, *tables[side], 1, engines[side]->features);
+        sanMoves.push_back(moveToSan(gs, r.bestMove, whiteTurn));
+        Undo u;
+        makeMove(gs, r.bestMove, u);
+        appendGameFeed(feed, gs, r.bestMove);
+        whiteTurn = !whiteTurn;
+        keyHistory.push_back(gs.key);
+        if (repetitionCount(keyHistory, gs.halfmoveClock) >= 3)
         {
-            if (!isSquareAttacked(board, 4, false) && !isSquareAttacked(board, 3, false) && !isSquareAttacked(board, 2, false))
-                addMove(moves, 4, 2, false);
+            termination = "threefold repetition";
+            return "1/2-1/2";
         }
-    }
-    else if (!white && me == 'k' && i == 60)
-    {
-        if (gs.blackCastleK && board[61] == '.' && board[62] == '.')
+        if (gs.halfmoveClock >= 100)
         {
-            if (!isSquareAttacked(board, 60, true) && !isSquareAttacked(board, 61, true) && !isSquareAttacked(board, 62, true))
-                addMove(moves, 60, 62, false);
+            termination = "50-move rule";
+            return "1/2-1/2";
         }
-        if (gs.blackCastleQ && board[59] == '.' && board[58] == '.' && board[57] == '.')
+        if (insufficientMaterial(gs))
         {
-            if (!isSquareAttacked(board, 60, true) && !isSquareAttacked(board, 59, true) && !isSquareAttacked(board, 58, true))
-                addMove(moves, 60, 58, false);
+            termination = "insufficient material";
+            return "1/2-1/2";
         }
     }
+    termination = "move limit";
+    return "1/2-1/2";
 }
 
-void generateAllMoves(const GameState &gs, bool whiteTurn, std::vector<Move> &moves)
+// Play one game; returns the PGN result and fills the moves and how the game ended
+std::string playMatchGame(const Opening &opening, const EngineConfig *engines[2], TranspositionTable *tables[2],
+                          std::vector<std::string> &sanMoves, std::string &termination)
 {
-    const Board &board = gs.board;
-    for (int i = 0; i < 64; ++i)
-    {
-        char p = board[i];
-        if (p == '.')
-            continue;
-        if (whiteTurn && !isWhite(p))
-            continue;
-        if (!whiteTurn && !isBlack(p))
-            continue;
-        switch (p)
-        {
-        case 'N':
-        case 'n':
-            generateKnightMoves(board, i, whiteTurn, moves);
-            break;
-        case 'B':
-        case 'b':
-            generateSlidingMoves(board, i, {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}}, moves);
-            break;
-        case 'R':
-        case 'r':
-            generateSlidingMoves(board, i, {{1, 0}, {-1, 0}, {0, 1}, {0, -1}}, moves);
-            break;
-        case 'Q':
-        case 'q':
-            generateSlidingMoves(board, i, {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}, {1, 0}, {-1, 0}, {0, 1}, {0, -1}}, moves);
-            break;
-        case 'K':
-        case 'k':
-            generateKingMoves(gs, i, moves);
-            break;
-        default:
-            break;
-        }
-    }
+    GameState gs = opening.gs;
+    bool whiteTurn = opening.whiteTurn;
+    std::vector<uint64_t> keyHistory{gs.key};
+    for (int c = 0; c < 2; ++c)
+        tables[c]->clear();
+    GameFeed feed;
+    startGameFeed(feed, gs, whiteTurn, ""); // spectators only
+    std::string result = playMatchMoves(gs, whiteTurn, engines, tables, keyHistory, feed, sanMoves, termination);
+    closeGameFeed(feed, result);
+    return result;
 }
 
-void generateLegalMoves(const GameState &gs, bool whiteTurn, std::vector<Move> &legal)
+// Results from the first engine's point of view
+struct MatchStats
 {
-    std::vector<Move> pseudo;
-    generatePawnMoves(gs, whiteTurn, pseudo);
-    generateAllMoves(gs, whiteTurn, pseudo);
-    for (auto &m : pseudo)
+    int wins = 0, losses = 0, draws = 0;
+    int games() const { return wins + losses + draws; }
+    double score() const { return games() ? (wins + 0.5 * draws) / games() : 0.5; }
+    // per-game variance of the score
+    double variance() const
     {
-        GameState ng = applyMove(gs, m);
-        int kingSq = findKingSquare(ng.board, whiteTurn);
-        if (kingSq == -1)
-            continue;
-        // if king is attacked by opponent after move, it's illegal
-        if (isSquareAttacked(ng.board, kingSq, !whiteTurn))
-            continue;
-        legal.push_back(m);
+        double s = score();
+        return games() ? (wins * (1 - s) * (1 - s) + losses * s * s + draws * (0.5 - s) * (0.5 - s)) / games() : 0;
     }
+};
+
+double eloFromScore(double s)
+{
+    s = std::min(std::max(s, 1e-6), 1 - 1e-6);
+    return -400.0 * std::log10(1.0 / s - 1.0);
 }
 
-// Check whether making move `m` from `gs` allows an immediate opponent capture on m.to
-// that results in a material swing <= threshold (from mover's perspective).
-bool allowsBadImmediateRecapture(const GameState &gs, const Move &m, bool whiteTurn, int threshold)
+double scoreFromElo(double elo) { return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0)); }
+
+// Log-likelihood ratio of H1 (elo1) against H0 (elo0), normal approximation of the trinomial GSPRT
+double sprtLlr(const MatchStats &st, double elo0, double elo1)
 {
-    GameState ng = applyMove(gs, m);
-    bool oppWhite = !whiteTurn;
-    std::vector<Move> oppMoves;
-    generateLegalMoves(ng, oppWhite, oppMoves);
-    int before = materialBalance(gs.board);
-    for (auto &r : oppMoves)
-    {
-        if (!r.isCapture)
-            continue;
-        if (r.to != m.to)
-            continue;
-        GameState ng2 = applyMove(ng, r);
-        int after = materialBalance(ng2.board);
-        int deltaWhite = after - before;
-        int deltaForMover = whiteTurn ? deltaWhite : -deltaWhite;
-        if (deltaForMover <= threshold)
-            return true;
-    }
-    return false;
+    double var = st.variance();
+    if (st.games() == 0 || var <= 0)
+        return 0;
+    double s0 = scoreFromElo(elo0), s1 = scoreFromElo(elo1);
+    return (s1 - s0) * (2 * st.score() - s0 - s1) / (2 * var / st.games());
 }
 
-// Aggressive evaluation: only counts capture opportunities and center control for side to move.
-int evaluateAggressive(const GameState &gs, bool whiteTurn)
+// `games` games (rounded up to pairs) between two engine configurations on `concurrency`
+// threads. Each opening is played twice with colors reversed; the games go to one PGN file
+// and the running score, Elo with 95% error bars and the SPRT (alpha = beta = 0.05) are
+// printed after every game. The match stops early once the SPRT accepts either hypothesis.
+void runMatch(int games, int concurrency, const EngineConfig &e1, const EngineConfig &e2, const std::string &openingsPath,
+              const std::string &pgnPath, double elo0, double elo1)
 {
-    std::vector<Move> moves;
-    generateLegalMoves(gs, whiteTurn, moves);
-    int captureCount = 0;
-    for (auto &m : moves)
-        if (m.isCapture)
-            ++captureCount;
+    int pairs = (games + 1) / 2;
+    std::vector<Opening> openings;
+    if (!openingsPath.empty())
+    {
+        if (!loadOpenings(openingsPath, openings))
+            return;
+    }
+    else
+        randomOpenings(pairs, 20240601ULL, openings);
 
-    // center squares: d4,e4,d5,e5 -> indices 27,28,35,36
-    const int centerIdx[4] = {27, 28, 35, 36};
-    int centerControl = 0;
-    for (int ci = 0; ci < 4; ++ci)
+    std::filesystem::path parent = std::filesystem::path(pgnPath).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent);
+    std::ofstream pgn(pgnPath);
+    if (!pgn)
     {
-        char c = gs.board[centerIdx[ci]];
-        if (c == '.')
-            continue;
-        if (whiteTurn && isWhite(c))
-            centerControl += 1;
-        if (!whiteTurn && isBlack(c))
-            centerControl += 1;
+        std::cout << "Cannot write " << pgnPath << "\n";
+        return;
     }
 
-    // score oriented to side-to-move (higher is better)
-    return captureCount * 800 + centerControl * 120;
+    const double lower = std::log(0.05 / 0.95), upper = std::log(0.95 / 0.05);
+    MatchStats stats;
+    std::mutex resultMutex;
+    std::atomic<int> next{0};
+    std::atomic<bool> decided{false};
+    std::string verdict;
+
+    auto worker = [&]()
+    {
+        TranspositionTable t1, t2;
+        t1.resize(e1.hashMB, false);
+        t2.resize(e2.hashMB, false);
+        for (int g = next++; g < pairs * 2 && !decided; g = next++)
+        {
+            const Opening &opening = openings[(g / 2) % openings.size()];
+            bool e1White = g % 2 == 0;
+            const EngineConfig *engines[2] = {e1White ? &e1 : &e2, e1White ? &e2 : &e1};
+            TranspositionTable *tables[2] = {e1White ? &t1 : &t2, e1White ? &t2 : &t1};
+            std::vector<std::string> sanMoves;
+            std::string termination;
+            std::string result = playMatchGame(opening, engines, tables, sanMoves, termination);
+
+            std::lock_guard<std::mutex> lock(resultMutex);
+            if (result == "1/2-1/2")
+                ++stats.draws;
+            else if ((result == "1-0") == e1White)
+                ++stats.wins;
+            else
+                ++stats.losses;
+            writePgn(pgn, "Match", std::to_string(g + 1), engines[WHITE]->name, engines[BLACK]->name, result,
+                     opening.gs, opening.whiteTurn, true, sanMoves);
+            pgn << "\n";
+
+            double s = stats.score(), margin = 1.96 * std::sqrt(stats.variance() / stats.games());
+            double elo = eloFromScore(s);
+            double error = (eloFromScore(s + margin) - eloFromScore(s - margin)) / 2;
+            double llr = sprtLlr(stats, elo0, elo1);
+            std::printf("Game %d: %s - %s %s (%s)\n", g + 1, engines[WHITE]->name.c_str(), engines[BLACK]->name.c_str(),
+                        result.c_str(), termination.c_str());
+            std::printf("Score of %s vs %s: %d - %d - %d [%.3f] %d\n", e1.name.c_str(), e2.name.c_str(), stats.wins,
+                        stats.losses, stats.draws, s, stats.games());
+            std::printf("Elo: %.1f +/- %.1f, LLR: %.2f (%.2f, %.2f) [%.1f, %.1f]\n", elo, error, llr, lower, upper, elo0, elo1);
+            std::fflush(stdout);
+            if (!decided && (llr >= upper || llr <= lower))
+            {
+                decided = true;
+                verdict = llr >= upper ? "H1 accepted" : "H0 accepted";
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, concurrency); ++t)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+
+    std::cout << "\nFinished " << stats.games() << " games: " << stats.wins << " - " << stats.losses << " - " << stats.draws
+              << ", SPRT: " << (verdict.empty() ? "no decision" : verdict) << "\nPGN written to " << pgnPath << "\n";
 }
 
-// Move ordering heuristic: prefer captures, then pawn double pushes on c/d/e, then center moves
-// forward declare helper used by moveHeuristic
-bool squareAttackedByAfterMove(const GameState &gs, const Move &m, bool byWhite);
+// --- Spectator server (--serve <port>) ---
+// Serves web/ over HTTP on localhost and pushes the records of the recent games (see GameFeed) to the
+// viewer with Server-Sent Events: GET /games lists the games, GET /events?game=<id> streams one
+// (all records so far, then each new one as it is published; without a game id the latest game).
+// One thread per connection, so any number of spectators can follow any number of games.
+#if defined(_WIN32)
+using SocketHandle = SOCKET;
+const SocketHandle NO_SOCKET = INVALID_SOCKET;
+void closeSocket(SocketHandle s) { closesocket(s); }
+#else
+using SocketHandle = int;
+const SocketHandle NO_SOCKET = -1;
+void closeSocket(SocketHandle s) { close(s); }
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS/BSD: startSpectatorServer ignores SIGPIPE instead
+#endif
 
-int moveHeuristic(const GameState &gs, const Move &m)
+bool sendAll(SocketHandle s, const std::string &data)
 {
-    int score = 0;
-    if (m.isCapture)
+    size_t sent = 0;
+    while (sent < data.size())
     {
-        score += 20000; // huge priority for captures
-        // penalize captures that leave the capturing piece on a square defended by the opponent
-        if (squareAttackedByAfterMove(gs, m, !isWhite(gs.board[m.from])))
-            score -= 15000; // discourage capturing a defended piece
+        int n = (int)send(s, data.data() + sent, (int)(data.size() - sent), MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += n;
     }
+    return true;
+}
 
-    // center target bonus
-    if (m.to == 27 || m.to == 28 || m.to == 35 || m.to == 36)
-        score += 500;
+void sendHttp(SocketHandle s, const std::string &status, const std::string &type, const std::string &body)
+{
+    sendAll(s, "HTTP/1.1 " + status + "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size()) +
+                   "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n" + body);
+}
 
-    // prefer two-step pawn pushes on files c(2)/d(3)/e(4)
-    int fromFile = m.from % 8;
-    if (abs(m.to - m.from) == 16)
+// Value of `name` in the query string, or "" when absent
+std::string queryParam(const std::string &target, const std::string &name)
+{
+    size_t q = target.find('?');
+    if (q == std::string::npos)
+        return "";
+    std::istringstream in(target.substr(q + 1));
+    std::string kv;
+    while (std::getline(in, kv, '&'))
+        if (kv.compare(0, name.size() + 1, name + "=") == 0)
+            return kv.substr(name.size() + 1);
+    return "";
+}
+
+void serveGameList(SocketHandle s)
+{
+    std::string body = "{\"games\": [";
     {
-        // verify it's a pawn by checking piece on source in current gs
-        char piece = gs.board[m.from];
-        if (piece == 'P' || piece == 'p')
+        std::lock_guard<std::mutex> lock(feedHub.mutex);
+        for (size_t g = 0; g < feedHub.games.size(); ++g)
         {
-            if (fromFile == 2 || fromFile == 3 || fromFile == 4)
-                score += 5000; // very desirable
+            const std::vector<std::string> &recs = feedHub.games[g];
+            bool over = recs.back()[0] == 'R';
+            if (g)
+                body += ", ";
+            body += "{\"id\": " + std::to_string(feedHub.firstId + g) + ", \"plies\": " + std::to_string(recs.size() - 1 - over) +
+                    ", \"result\": \"" + (over ? recs.back().substr(2) : "*") + "\"}";
         }
     }
-    return score;
+    body += "] }";
+    sendHttp(s, "200 OK", "application/json", body);
 }
 
-// Determine if the square 'sq' is attacked by side 'byWhite' (wrapper of isSquareAttacked)
-bool squareAttackedByAfterMove(const GameState &gs, const Move &m, bool byWhite)
+// Stream the records of one game from index `next` on until the client goes away or the game
+// is dropped from the hub. An unknown game is a 404, which an EventSource does not retry.
+void serveEvents(SocketHandle s, int game, size_t next)
 {
-    GameState ng = applyMove(gs, m);
-    return isSquareAttacked(ng.board, m.to, byWhite);
+    std::unique_lock<std::mutex> lock(feedHub.mutex);
+    if (game < 0)
+    {
+        feedHub.changed.wait(lock, [] { return !feedHub.games.empty(); });
+        game = feedHub.firstId + (int)feedHub.games.size() - 1;
+    }
+    if (!feedHub.game(game))
+    {
+        lock.unlock();
+        sendHttp(s, "404 Not Found", "text/plain", "no such game\n");
+        return;
+    }
+    lock.unlock();
+    if (!sendAll(s, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                    "Connection: keep-alive\r\n\r\n"))
+        return;
+    lock.lock();
+    for (;;)
+    {
+        const std::vector<std::string> *recs = feedHub.game(game);
+        if (!recs)
+            return;
+        std::string out;
+        for (; next < recs->size(); ++next)
+            out += "id: " + std::to_string(next) + "\ndata: " + (*recs)[next] + "\n\n";
+        lock.unlock();
+        // a comment line every 15 s finds spectators that have gone away
+        if (!sendAll(s, out.empty() ? ": ping\n\n" : out))
+            return;
+        lock.lock();
+        feedHub.changed.wait_for(lock, std::chrono::seconds(15), [&]
+                                 { const std::vector<std::string> *r = feedHub.game(game);
+                                   return !r || r->size() > next; });
+    }
 }
 
-int negamax(const GameState &gs, bool whiteTurn, int depth, int alpha, int beta)
+void serveStatic(SocketHandle s, std::string path)
 {
-    if (depth == 0)
-        return evaluateAggressive(gs, whiteTurn);
-
-    std::vector<Move> moves;
-    generateLegalMoves(gs, whiteTurn, moves);
-    if (moves.empty())
+    if (path == "/")
+        path = "/index.html";
+    if (path.find("..") != std::string::npos)
     {
-        int kingSq = findKingSquare(gs.board, whiteTurn);
-        bool inCheck = (kingSq != -1) && isSquareAttacked(gs.board, kingSq, !whiteTurn);
-        if (inCheck)
-            return -100000 + (3 - depth); // checkmate worse for side to move
-        else
-            return 0; // stalemate
+        sendHttp(s, "403 Forbidden", "text/plain", "forbidden\n");
+        return;
     }
+    std::ifstream f("web" + path, std::ios::binary);
+    if (!f)
+    {
+        sendHttp(s, "404 Not Found", "text/plain", "not found\n");
+        return;
+    }
+    std::string body((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::string type = ext == ".html"  ? "text/html; charset=utf-8"
+                       : ext == ".js"  ? "text/javascript; charset=utf-8"
+                       : ext == ".css" ? "text/css; charset=utf-8"
+                       : ext == ".json" ? "application/json"
+                                        : "text/plain; charset=utf-8";
+    sendHttp(s, "200 OK", type, body);
+}
 
-    // order moves by heuristic descending
-    std::sort(moves.begin(), moves.end(), [&](const Move &a, const Move &b)
-              { return moveHeuristic(gs, a) > moveHeuristic(gs, b); });
-
-    int best = -1000000;
-    for (auto &m : moves)
+void serveConnection(SocketHandle s)
+{
+    std::string request;
+    char buf[2048];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384)
     {
-        GameState ng = applyMove(gs, m);
-        // avoid immediate large material loss in deeper search as well
-        int deltaWhite = materialBalance(ng.board) - materialBalance(gs.board);
-        int deltaForSide = whiteTurn ? deltaWhite : -deltaWhite;
-        if (deltaForSide <= -4)
-            continue;
-        if (allowsBadImmediateRecapture(gs, m, whiteTurn, -4))
-            continue;
+        int n = (int)recv(s, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            closeSocket(s);
+            return;
+        }
+        request.append(buf, n);
+    }
+    std::istringstream in(request);
+    std::string method, target;
+    in >> method >> target;
+    std::string path = target.substr(0, target.find('?'));
+    if (method != "GET")
+        sendHttp(s, "405 Method Not Allowed", "text/plain", "GET only\n");
+    else if (path == "/games")
+        serveGameList(s);
+    else if (path == "/events")
+    {
+        std::string game = queryParam(target, "game");
+        // a reconnecting EventSource resumes after the last record it received; not without a
+        // game id, since the latest game may have changed since (the viewer asks /games first)
+        size_t next = 0;
+        std::string line;
+        while (!game.empty() && std::getline(in, line))
+            if (line.compare(0, 14, "Last-Event-ID:") == 0)
+                next = std::strtoul(line.c_str() + 14, nullptr, 10) + 1;
+        serveEvents(s, game.empty() ? -1 : std::atoi(game.c_str()), next);
+    }
+    else
+        serveStatic(s, path);
+    closeSocket(s);
+}
 
-        int val = -negamax(ng, !whiteTurn, depth - 1, -beta, -alpha);
-        if (val > best)
-            best = val;
-        if (best > alpha)
-            alpha = best;
-        if (alpha >= beta)
-            break;
+// Listen on 127.0.0.1:`port` and accept connections on a background thread
+bool startSpectatorServer(int port)
+{
+#if defined(_WIN32)
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return false;
+#else
+    // a spectator closing its tab must fail the send, not kill the game
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == NO_SOCKET)
+        return false;
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0)
+    {
+        closeSocket(listener);
+        return false;
     }
-    return best;
+    feedHub.enabled = true;
+    std::thread([listener]()
+                {
+                    for (;;)
+                    {
+                        SocketHandle s = accept(listener, nullptr, nullptr);
+                        if (s != NO_SOCKET)
+                            std::thread(serveConnection, s).detach();
+                    }
+                })
+        .detach();
+    return true;
 }
 
-Move searchBestMove(const GameState &gs, bool whiteTurn, int depth)
+// --- UCI ---
+// Time for one move from the clock: aim at an even share of the remaining time plus most of
+// the increment, never more than half of what is left.
+void uciTimeLimits(SearchLimits &limits, int64_t timeLeft, int64_t inc, int movesToGo)
 {
-    std::vector<Move> moves;
-    generateLegalMoves(gs, whiteTurn, moves);
-    if (moves.empty())
-        return {0, 0, false, '\0'};
+    const int64_t overhead = 30; // GUI and pipe latency
+    int64_t available = std::max<int64_t>(timeLeft - overhead, 1);
+    int64_t optimum = available / (movesToGo > 0 ? movesToGo : 30) + inc * 3 / 4;
+    limits.hardMs = std::max<int64_t>(1, std::min(optimum * 3, available / 2));
+    limits.softMs = std::max<int64_t>(1, std::min(optimum, limits.hardMs) / 2);
+}
 
-    // order moves by heuristic
-    std::sort(moves.begin(), moves.end(), [&](const Move &a, const Move &b)
-              { return moveHeuristic(gs, a) > moveHeuristic(gs, b); });
-    // avoid immediate large material loss: threshold is material points (side-perspective)
-    const int materialLossThreshold = -4; // disallow moves that immediately lose >= 4 points
-    int skipped = 0;
-    Move bestMove = moves[0];
-    int alpha = -1000000, beta = 1000000;
-    for (auto &m : moves)
+// Apply a move given in coordinate notation if it is legal in `gs`
+bool applyUciMove(GameState &gs, bool &whiteTurn, const std::string &text)
+{
+    MoveList legal;
+    generateLegalMoves(gs, whiteTurn, legal);
+    for (const Move &m : legal)
+        if (moveString(m) == text)
+        {
+            Undo u;
+            makeMove(gs, m, u);
+            whiteTurn = !whiteTurn;
+            return true;
+        }
+    return false;
+}
+
+// UCI front end: this thread reads commands while the search runs on a worker thread, so
+// "stop", "ponderhit" and "isready" are handled at once. "go infinite" and "go ponder" keep
+// the best move back until "stop" (or "ponderhit", for pondering) arrives, as UCI requires.
+void runUci(bool largePages)
+{
+    GameState gs = initialPosition();
+    bool whiteTurn = true;
+    std::thread worker;
+    std::atomic<bool> stopFlag{false};
+    std::atomic<bool> ponderFlag{false};
+    std::atomic<bool> infinite{false};
+    bool ownBook = book.loaded();
+    Prng bookRng{(uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1};
+
+    auto finishSearch = [&]
+    {
+        stopFlag = true;
+        if (worker.joinable())
+            worker.join();
+    };
+
+    std::string line;
+    while (std::getline(std::cin, line))
     {
-        GameState ng = applyMove(gs, m);
-        int deltaWhite = materialBalance(ng.board) - materialBalance(gs.board);
-        int deltaForSide = whiteTurn ? deltaWhite : -deltaWhite;
-        if (deltaForSide <= materialLossThreshold)
+        std::istringstream in(line);
+        std::string cmd;
+        in >> cmd;
+        if (cmd == "uci")
         {
-            ++skipped;
-            continue;
+            std::cout << "id name Chess\n"
+                      << "id author Chess developers\n"
+                      << "option name Hash type spin default 16 min 1 max 65536\n"
+                      << "option name Threads type spin default 1 min 1 max 256\n"
+                      << "option name Ponder type check default false\n"
+                      << "option name OwnBook type check default " << (book.loaded() ? "true" : "false") << "\n"
+                      << "uciok" << std::endl;
         }
-        // also check for immediate recapture by opponent that causes large loss
-        if (allowsBadImmediateRecapture(gs, m, whiteTurn, materialLossThreshold))
+        else if (cmd == "isready")
+            std::cout << "readyok" << std::endl;
+        else if (cmd == "setoption")
         {
-            ++skipped;
-            continue;
+            // setoption name <id> value <x>
+            std::string token, name, value;
+            in >> token >> name;
+            while (in >> token && token != "value")
+                name += " " + token;
+            in >> value;
+            finishSearch();
+            if (name == "Hash")
+                tt.resize(std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10)), largePages);
+            else if (name == "Threads")
+                searchThreads = std::max(1, std::atoi(value.c_str()));
+            else if (name == "OwnBook")
+                ownBook = value == "true" && book.loaded();
         }
-        int val = -negamax(ng, !whiteTurn, depth - 1, -beta, -alpha);
-        if (val > alpha)
+        else if (cmd == "ucinewgame")
         {
-            alpha = val;
-            bestMove = m;
+            finishSearch();
+            tt.clear();
         }
-    }
-    // if we skipped all moves, allow them (no legal safe move)
-    if (skipped == (int)moves.size())
-    {
-        alpha = -1000000;
-        for (auto &m : moves)
+        else if (cmd == "position")
         {
-            GameState ng = applyMove(gs, m);
-            int val = -negamax(ng, !whiteTurn, depth - 1, -beta, -alpha);
-            if (val > alpha)
+            finishSearch();
+            std::string token;
+            in >> token;
+            if (token == "startpos")
+            {
+                gs = initialPosition();
+                whiteTurn = true;
+                in >> token; // "moves", if any
+            }
+            else if (token == "fen")
+            {
+                std::string fen;
+                while (in >> token && token != "moves")
+                    fen += (fen.empty() ? "" : " ") + token;
+                if (!parseFen(fen, gs, whiteTurn))
+                {
+                    std::cout << "info string invalid fen " << fen << std::endl;
+                    continue;
+                }
+            }
+            while (in >> token)
+                if (!applyUciMove(gs, whiteTurn, token))
+                {
+                    std::cout << "info string illegal move " << token << std::endl;
+                    break;
+                }
+        }
+        else if (cmd == "go")
+        {
+            finishSearch();
+            SearchLimits limits;
+            limits.report = true;
+            limits.stop = &stopFlag;
+            int64_t wtime = -1, btime = -1, winc = 0, binc = 0, movetime = 0;
+            int movesToGo = 0;
+            bool ponder = false, inf = false;
+            std::string token;
+            while (in >> token)
             {
-                alpha = val;
-                bestMove = m;
+                if (token == "wtime")
+                    in >> wtime;
+                else if (token == "btime")
+                    in >> btime;
+                else if (token == "winc")
+                    in >> winc;
+                else if (token == "binc")
+                    in >> binc;
+                else if (token == "movestogo")
+                    in >> movesToGo;
+                else if (token == "movetime")
+                    in >> movetime;
+                else if (token == "depth")
+                {
+                    in >> limits.depth;
+                    limits.depth = std::max(1, std::min(MAX_PLY - 1, limits.depth));
+                }
+                else if (token == "nodes")
+                    in >> limits.nodes;
+                else if (token == "infinite")
+                    inf = true;
+                else if (token == "ponder")
+                    ponder = true;
+            }
+            int64_t timeLeft = whiteTurn ? wtime : btime;
+            if (movetime > 0)
+            {
+                limits.hardMs = movetime;
+                limits.softMs = movetime / 2;
             }
+            else if (timeLeft >= 0)
+                uciTimeLimits(limits, timeLeft, whiteTurn ? winc : binc, movesToGo);
+            stopFlag = false;
+            ponderFlag = ponder;
+            infinite = inf;
+            if (ponder)
+                limits.ponder = &ponderFlag;
+            // a book move is answered at once; pondering and infinite analysis still search
+            Move bookMove = ownBook && !ponder && !inf ? probeBook(book, gs, whiteTurn, bookRng) : Move();
+            if (!bookMove.isNull())
+            {
+                std::cout << "bestmove " << moveString(bookMove) << std::endl;
+                continue;
+            }
+
+            worker = std::thread([&, limits]
+                                 {
+                SearchResult r = searchBestMove(gs, whiteTurn, limits);
+                // the best move may only be sent once the GUI has ended infinite or ponder mode
+                while ((infinite || ponderFlag) && !stopFlag)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                std::string out = "bestmove " + (r.bestMove.isNull() ? std::string("0000") : moveString(r.bestMove));
+                if (r.pv.size() >= 2)
+                    out += " ponder " + moveString(r.pv[1]);
+                std::cout << out + "\n" << std::flush; });
         }
+        else if (cmd == "stop")
+            finishSearch();
+        else if (cmd == "ponderhit")
+            ponderFlag = false;
+        else if (cmd == "quit")
+            break;
+        else if (cmd == "d")
+            std::cout << toFen(gs, whiteTurn) << std::endl;
     }
-    return bestMove;
+    finishSearch();
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    // Setup board
-    Board board{};
-    for (int i = 0; i < 64; i++)
-        board[i] = '.';
-    for (int i = 0; i < 8; i++)
+    // command line: --hash <MB> sets the transposition table size, --large-pages requests huge pages for it.
+    // --movetime <ms> is the thinking budget per move; --depth and --nodes cap the search instead of / on top of it.
+    // --threads <n> searches with n threads; --smp-bench <depth> prints thread scaling numbers and exits.
+    // --perft <depth> prints a divide of the start position, --perft-suite checks the reference
+    // positions (--perft-hash <MB> caches subtree counts), --bench [depth] prints the search signature.
+    // --fen "<fen>" starts the game (or perft) from that position instead of the initial one.
+    // --epd <file> runs a test suite on --epd-threads workers (default: all cores), each position
+    // searched for --movetime, or only to --depth when --depth is given without --movetime.
+    // --nnue <file> evaluates with that network instead of the hand-written evaluation;
+    // --nnue-scalar disables the SIMD kernels (to compare speed and check results).
+    // --no-pvs, --no-null-move, --no-lmr and --no-check-extensions switch off those search techniques.
+    // --uci speaks the UCI protocol on stdin/stdout instead of playing a game against itself.
+    // --match <games> plays two configurations against each other on --concurrency threads (default:
+    // all cores); --engine1/--engine2 "<opts>" configure them (see parseEngineConfig) on top of
+    // --movetime/--depth/--nodes, --openings <file> supplies FEN/EPD openings (default: random),
+    // --match-pgn <file> collects the games and --sprt <elo0> <elo1> sets the test bounds (0 5).
+    // --headless plays the game without board printing, web UI files or pauses (only the result and
+    // the PGN are reported); --pace <ms> is the pause after each move for the web viewer (default 1000).
+    // --book <file> plays from that opening book while it has the position; --build-book <file> writes a
+    // book from the first --book-plies plies (default 20) of the games in --book-source (default pgns/).
+    // --tb <dir> probes the endgame tablebases in dir during the search; --tb-generate <dir> writes
+    // them for all endings of up to --tb-men men (default 4) using --concurrency threads, then
+    // probes the tablebase check positions.
+    // --pgn-replay <file> parses and replays every game of a PGN database on --concurrency threads.
+    // --serve <port> serves web/ on localhost and pushes every move of the game (or of all --match
+    // games) to the viewer as it is played; the process keeps serving until Enter is pressed.
+    size_t hashMB = 16;
+    std::string nnuePath;
+    bool nnueScalar = false;
+    bool uciMode = false;
+    bool headless = false;
+    int paceMs = 1000;
+    int servePort = 0;
+    std::string pgnReplayPath;
+    std::string bookPath, buildBookPath;
+    std::string bookSource = "pgns";
+    int bookPlies = 20;
+    std::string tbPath, tbGeneratePath;
+    int tbMen = TB_MAX_MEN;
+    int matchGames = 0;
+    int concurrency = (int)std::max(1u, std::thread::hardware_concurrency());
+    std::string engine1Spec, engine2Spec, openingsPath;
+    std::string matchPgn = "pgns/match.pgn";
+    double sprtElo0 = 0, sprtElo1 = 5;
+    std::string startFen;
+    std::string epdPath;
+    int epdThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    bool moveTimeGiven = false;
+    int smpBenchDepth = 0;
+    int perftDepth = 0;
+    bool perftSuiteMode = false;
+    size_t perftHashMB = 0;
+    int benchDepth = 0;
+    bool largePages = false;
+    SearchLimits limits;
+    int64_t moveTimeMs = 1000;
+    for (int i = 1; i < argc; ++i)
     {
-        board[1 * 8 + i] = 'P';
-        board[6 * 8 + i] = 'p';
-        if (i == 0 || i == 7)
+        std::string arg = argv[i];
+        if (arg == "--hash" && i + 1 < argc)
+            hashMB = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--large-pages")
+            largePages = true;
+        else if (arg == "--movetime" && i + 1 < argc)
         {
-            board[0 * 8 + i] = 'R';
-            board[7 * 8 + i] = 'r';
-        }
-        else if (i == 1 || i == 6)
-        {
-            board[0 * 8 + i] = 'N';
-            board[7 * 8 + i] = 'n';
+            moveTimeMs = std::strtoll(argv[++i], nullptr, 10);
+            moveTimeGiven = true;
         }
-        else if (i == 2 || i == 5)
+        else if (arg == "--depth" && i + 1 < argc)
+            limits.depth = std::max(1, std::min(MAX_PLY - 1, std::atoi(argv[++i])));
+        else if (arg == "--nodes" && i + 1 < argc)
+            limits.nodes = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--threads" && i + 1 < argc)
+            searchThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--smp-bench" && i + 1 < argc)
+            smpBenchDepth = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--perft" && i + 1 < argc)
+            perftDepth = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--perft-suite")
+            perftSuiteMode = true;
+        else if (arg == "--perft-hash" && i + 1 < argc)
+            perftHashMB = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--bench")
+            benchDepth = (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) ? std::max(1, std::atoi(argv[++i])) : 5;
+        else if (arg == "--fen" && i + 1 < argc)
+            startFen = argv[++i];
+        else if (arg == "--epd" && i + 1 < argc)
+            epdPath = argv[++i];
+        else if (arg == "--epd-threads" && i + 1 < argc)
+            epdThreads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--nnue" && i + 1 < argc)
+            nnuePath = argv[++i];
+        else if (arg == "--nnue-scalar")
+            nnueScalar = true;
+        else if (arg == "--uci")
+            uciMode = true;
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--pace" && i + 1 < argc)
+            paceMs = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--serve" && i + 1 < argc)
+            servePort = std::atoi(argv[++i]);
+        else if (arg == "--pgn-replay" && i + 1 < argc)
+            pgnReplayPath = argv[++i];
+        else if (arg == "--book" && i + 1 < argc)
+            bookPath = argv[++i];
+        else if (arg == "--build-book" && i + 1 < argc)
+            buildBookPath = argv[++i];
+        else if (arg == "--book-source" && i + 1 < argc)
+            bookSource = argv[++i];
+        else if (arg == "--book-plies" && i + 1 < argc)
+            bookPlies = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--tb" && i + 1 < argc)
+            tbPath = argv[++i];
+        else if (arg == "--tb-generate" && i + 1 < argc)
+            tbGeneratePath = argv[++i];
+        else if (arg == "--tb-men" && i + 1 < argc)
+            tbMen = std::max(3, std::min(TB_MAX_MEN, std::atoi(argv[++i])));
+        else if (arg == "--match" && i + 1 < argc)
+            matchGames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--concurrency" && i + 1 < argc)
+            concurrency = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--engine1" && i + 1 < argc)
+            engine1Spec = argv[++i];
+        else if (arg == "--engine2" && i + 1 < argc)
+            engine2Spec = argv[++i];
+        else if (arg == "--openings" && i + 1 < argc)
+            openingsPath = argv[++i];
+        else if (arg == "--match-pgn" && i + 1 < argc)
+            matchPgn = argv[++i];
+        else if (arg == "--sprt" && i + 2 < argc)
         {
-            board[0 * 8 + i] = 'B';
-            board[7 * 8 + i] = 'b';
+            sprtElo0 = std::atof(argv[++i]);
+            sprtElo1 = std::atof(argv[++i]);
         }
-        else if (i == 3)
+        else if (arg == "--no-pvs")
+            searchFeatures.pvs = false;
+        else if (arg == "--no-null-move")
+            searchFeatures.nullMove = false;
+        else if (arg == "--no-lmr")
+            searchFeatures.lmr = false;
+        else if (arg == "--no-check-extensions")
+            searchFeatures.checkExtensions = false;
+    }
+    // an iteration rarely takes less than the previous ones combined, so stop starting new ones at half the budget
+    limits.softMs = moveTimeMs / 2;
+    limits.hardMs = moveTimeMs;
+
+    initAttackTables();
+    initZobrist();
+    initEvalTables();
+    initSearchTables();
+    initTablebaseIndex();
+    selectNnueKernels(nnueScalar);
+    // the accumulators are built from the board at the start of every search
+    if (!nnuePath.empty())
+    {
+        if (!loadNetwork(nnuePath))
+            return 1;
+        std::cout << "NNUE " << nnuePath << " loaded, " << nnueKernelName << " kernels\n";
+    }
+    tt.resize(hashMB, largePages);
+
+    if (!tbGeneratePath.empty())
+        return generateTablebases(tbGeneratePath, tbMen, concurrency) && runTablebaseChecks() ? 0 : 1;
+    if (!tbPath.empty() && !loadTablebases(tbPath))
+    {
+        std::cout << "No tablebases found in " << tbPath << "\n";
+        return 1;
+    }
+    if (!buildBookPath.empty())
+        return buildBook(bookSource, buildBookPath, bookPlies, concurrency) ? 0 : 1;
+    if (!bookPath.empty() && !book.open(bookPath))
+    {
+        std::cout << "Cannot load opening book " << bookPath << "\n";
+        return 1;
+    }
+    if (uciMode)
+    {
+        runUci(largePages);
+        return 0;
+    }
+    if (servePort)
+    {
+        if (!startSpectatorServer(servePort))
         {
-            board[0 * 8 + i] = 'Q';
-            board[7 * 8 + i] = 'q';
+            std::cout << "Cannot listen on port " << servePort << "\n";
+            return 1;
         }
-        else if (i == 4)
+        std::cout << "Serving the viewer on http://127.0.0.1:" << servePort << "/\n";
+    }
+    // spectators can still replay the finished games
+    auto keepServing = [&]()
+    {
+        if (!servePort)
+            return;
+        std::cout << "Still serving on port " << servePort << ", press Enter to quit\n";
+        std::string line;
+        std::getline(std::cin, line);
+    };
+    if (matchGames)
+    {
+        EngineConfig e1, e2;
+        if (!parseEngineConfig(engine1Spec, limits, e1) || !parseEngineConfig(engine2Spec, limits, e2))
+            return 1;
+        if (e1.name == e2.name)
         {
-            board[0 * 8 + i] = 'K';
-            board[7 * 8 + i] = 'k';
+            e1.name += " (1)";
+            e2.name += " (2)";
         }
+        runMatch(matchGames, concurrency, e1, e2, openingsPath, matchPgn, sprtElo0, sprtElo1);
+        keepServing();
+        return 0;
+    }
+    if (!pgnReplayPath.empty())
+    {
+        runPgnReplay(pgnReplayPath, concurrency);
+        return 0;
+    }
+    if (smpBenchDepth)
+    {
+        runSmpBench(smpBenchDepth);
+        return 0;
+    }
+    if (!epdPath.empty())
+    {
+        SearchLimits epdLimits = limits;
+        if (limits.depth < MAX_PLY - 1 && !moveTimeGiven)
+            epdLimits.softMs = epdLimits.hardMs = 0;
+        runEpdSuite(epdPath, epdLimits, epdThreads, hashMB);
+        return 0;
     }
 
-    GameState gs;
-    gs.board = board;
+    GameState gs = initialPosition();
+    bool whiteTurn = true;
+    if (!startFen.empty() && !parseFen(startFen, gs, whiteTurn))
+    {
+        std::cout << "Invalid FEN: " << startFen << "\n";
+        return 1;
+    }
+    const GameState startGs = gs;
+    const bool startWhite = whiteTurn;
 
-    // write initial board JSON for web UI and start a positions history
-    std::vector<Board> positions;
-    positions.push_back(gs.board);
-    writeBoardJson(gs);
-    writeGameJson(positions);
-    // give the web UI time to load the initial position
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    if (perftDepth || perftSuiteMode)
+    {
+        resizePerftTable(perftHashMB);
+        if (perftSuiteMode)
+            return runPerftSuite() ? 0 : 1;
+        perftDivide(gs, whiteTurn, perftDepth);
+        return 0;
+    }
+    if (benchDepth)
+    {
+        runBench(benchDepth);
+        return 0;
+    }
 
-    printBoard(gs.board);
+    // write initial board JSON for web UI and start the game feed
+    GameFeed feed;
+    if (headless)
+        startGameFeed(feed, gs, whiteTurn, ""); // spectators only, if serving
+    else
+    {
+        writeBoardJson(gs);
+        if (!startGameFeed(feed, gs, whiteTurn))
+            std::cout << "Cannot write the game feed web/game.feed\n";
+        // give the web UI time to load the initial position
+        std::this_thread::sleep_for(std::chrono::milliseconds(paceMs));
+        printBoard(gs.board);
+    }
 
-    bool whiteTurn = true;
     const int maxPlies = 1000; // safety cap to avoid infinite loops
     int turn = 0;
-    int halfmoveClock = 0; // halfmoves since last pawn move or capture
-    std::unordered_map<std::string, int> repetitionCount;
-    // record initial position
-    repetitionCount[positionKey(gs, whiteTurn)] = 1;
+    // Zobrist keys of every position reached, in game order (repetition detection)
+    std::vector<uint64_t> keyHistory;
+    keyHistory.push_back(gs.key);
 
     std::vector<std::string> pgnMoves;
     std::string gameResult = "*";
+    limits.report = !headless; // show the line the engine expects after each iteration
+    Prng bookRng{(uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() | 1};
 
     for (; turn < maxPlies; ++turn)
     {
-        std::vector<Move> legal;
+        MoveList legal;
         generateLegalMoves(gs, whiteTurn, legal);
         if (legal.empty())
         {
-            int kingSq = findKingSquare(gs.board, whiteTurn);
-            bool inCheck = (kingSq != -1) && isSquareAttacked(gs.board, kingSq, !whiteTurn);
+            int kingSq = findKingSquare(gs, whiteTurn);
+            bool inCheck = (kingSq != -1) && isSquareAttacked(gs, kingSq, !whiteTurn);
             if (inCheck)
             {
                 std::cout << (whiteTurn ? "White" : "Black") << " is checkmated!\n";
@@ -969,102 +5546,45 @@ int main()
             break;
         }
 
-        // pick best move using negamax alpha-beta with aggressive priorities
-        const int searchDepth = 3; // tune depth as desired
-        Move bestMove = searchBestMove(gs, whiteTurn, searchDepth);
+        // a book move if there is one, otherwise iterative deepening negamax alpha-beta
+        SearchResult sr;
+        sr.bestMove = probeBook(book, gs, whiteTurn, bookRng);
+        bool fromBook = !sr.bestMove.isNull();
+        if (!fromBook)
+            sr = searchBestMove(gs, whiteTurn, limits);
+        Move bestMove = sr.bestMove;
 
-        std::cout << "\n"
-                  << (whiteTurn ? "White" : "Black") << " plays: " << squareName(bestMove.from) << " -> " << squareName(bestMove.to) << "\n";
-
-        // SAN generation (simple): castling, piece letter, captures, promotions, check/mate marker
-        auto moveToSAN = [&](const GameState &curGs, const Move &m, bool curWhite) -> std::string
-        {
-            char piece = curGs.board[m.from];
-            // castling
-            if ((piece == 'K' || piece == 'k') && abs((m.to % 8) - (m.from % 8)) == 2)
-            {
-                if ((m.to % 8) == 6)
-                    return std::string("O-O");
-                else
-                    return std::string("O-O-O");
-            }
-            std::string san;
-            bool isPawn = (piece == 'P' || piece == 'p');
-            if (isPawn)
-            {
-                if (m.isCapture)
-                {
-                    char file = 'a' + (m.from % 8);
-                    san.push_back(file);
-                    san.push_back('x');
-                }
-                san += squareName(m.to);
-                if (m.promotion != '\0')
-                {
-                    san.push_back('=');
-                    san.push_back((char)toupper((unsigned char)m.promotion));
-                }
-            }
-            else
-            {
-                // ensure piece letter is present; if source square somehow empty, attempt to infer
-                char up = '?';
-                if (piece != '.' && piece != '\0')
-                    up = (char)toupper((unsigned char)piece);
-                else
-                {
-                    // fallback: infer by scanning legal pieces that could move to m.from (best-effort)
-                    up = 'P';
-                }
-                san.push_back(up);
-                if (m.isCapture)
-                    san.push_back('x');
-                san += squareName(m.to);
-            }
+        if (!headless && fromBook)
+            std::cout << "\n"
+                      << (whiteTurn ? "White" : "Black") << " plays: " << squareName(bestMove.from()) << " -> " << squareName(bestMove.to()) << " (book)\n";
+        else if (!headless)
+            std::cout << "\n"
+                      << (whiteTurn ? "White" : "Black") << " plays: " << squareName(bestMove.from()) << " -> " << squareName(bestMove.to())
+                      << " (depth " << sr.depth << ", score " << sr.score << ", " << sr.nodes << " nodes, " << sr.elapsedMs << " ms)\n";
 
-            // check/mate detection
-            GameState ng = applyMove(curGs, m);
-            bool oppIsWhite = !curWhite;
-            int oppKing = findKingSquare(ng.board, oppIsWhite);
-            bool inCheck = (oppKing != -1) && isSquareAttacked(ng.board, oppKing, curWhite);
-            std::vector<Move> oppMoves;
-            generateLegalMoves(ng, oppIsWhite, oppMoves);
-            if (inCheck && oppMoves.empty())
-                san += '#';
-            else if (inCheck)
-                san += '+';
-
-            return san;
-        };
-
-        std::string san = moveToSAN(gs, bestMove, whiteTurn);
-
-        // update halfmove clock: reset on pawn move or capture
-        char movingPiece = gs.board[bestMove.from];
-        if (movingPiece == 'P' || movingPiece == 'p' || bestMove.isCapture)
-            halfmoveClock = 0;
-        else
-            ++halfmoveClock;
+        std::string san = moveToSan(gs, bestMove, whiteTurn);
 
-        // apply move and record SAN
-        GameState oldGs = gs;
-        gs = applyMove(gs, bestMove);
+        // apply move (also updates the halfmove clock) and record SAN
+        Undo undo;
+        makeMove(gs, bestMove, undo);
         pgnMoves.push_back(san);
 
         // toggle side to move
         whiteTurn = !whiteTurn;
 
-        printBoard(gs.board);
-        // update JSON for web UI and pause so browser can display the move
-        positions.push_back(gs.board);
-        writeBoardJson(gs);
-        writeGameJson(positions);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        appendGameFeed(feed, gs, bestMove);
+        if (!headless)
+        {
+            printBoard(gs.board);
+            // update the web UI files and pause so browser can display the move
+            writeBoardJson(gs);
+            std::this_thread::sleep_for(std::chrono::milliseconds(paceMs));
+        }
 
         // repetition detection (threefold)
-        std::string key = positionKey(gs, whiteTurn);
-        int cnt = ++repetitionCount[key];
-        if (cnt >= 3)
+        // only positions since the last irreversible move, with the same side to move, can repeat
+        keyHistory.push_back(gs.key);
+        if (repetitionCount(keyHistory, gs.halfmoveClock) >= 3)
         {
             std::cout << "Draw by threefold repetition.\n";
             gameResult = "1/2-1/2";
@@ -1072,7 +5592,7 @@ int main()
         }
 
         // 50-move rule: 100 halfmoves = 50 moves each
-        if (halfmoveClock >= 100)
+        if (gs.halfmoveClock >= 100)
         {
             std::cout << "Draw by 50-move rule.\n";
             gameResult = "1/2-1/2";
@@ -1080,6 +5600,8 @@ int main()
         }
     }
 
+    closeGameFeed(feed, gameResult);
+
     // write PGN file if we have moves
     if (!pgnMoves.empty())
     {
@@ -1095,33 +5617,7 @@ int main()
         std::ofstream pf(base);
         if (pf)
         {
-            // header
-            std::time_t t = std::time(nullptr);
-            std::tm tm = *std::localtime(&t);
-            char datebuf[32];
-            std::snprintf(datebuf, sizeof(datebuf), "%04d.%02d.%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
-            pf << "[Event \"Friendly Game\"]\n";
-            pf << "[Site \"Local\"]\n";
-            pf << "[Date \"" << datebuf << "\"]\n";
-            pf << "[Round \"-\"]\n";
-            pf << "[White \"White\"]\n";
-            pf << "[Black \"Black\"]\n";
-            pf << "[Result \"" << gameResult << "\"]\n\n";
-
-            // movetext
-            for (size_t i = 0; i < pgnMoves.size(); ++i)
-            {
-                if (i % 2 == 0)
-                {
-                    pf << (i / 2 + 1) << ". ";
-                }
-                pf << pgnMoves[i];
-                if (i % 2 == 1)
-                    pf << ' ';
-                else
-                    pf << ' ';
-            }
-            pf << " " << gameResult << "\n";
+            writePgn(pf, "Friendly Game", "-", "White", "Black", gameResult, startGs, startWhite, !startFen.empty(), pgnMoves);
             pf.close();
             std::cout << "Wrote PGN to " << base << "\n";
         }
@@ -1131,5 +5627,6 @@ int main()
         }
     }
 
+    keepServing();
     return 0;
 }
@@ -25,18 +25,65 @@ function renderIndex(idx) {
   document.getElementById('moveLabel').textContent = `Move: ${idx} / ${positions.length-1}`;
 }
 
+// game.feed is append-only: fetch only the bytes past `offset` and apply complete lines
+// ("G <board> <side>" starts a game, "M <ply> <move> <sq><piece>..." changes squares)
+let offset = 0;
+
+function resetFeed() {
+  offset = 0;
+  positions = [];
+  current = 0;
+}
+
+function applyRecord(line) {
+  const parts = line.split(' ');
+  if (parts[0] === 'G') {
+    positions = [parts[1].split('')];
+    current = 0;
+    return true;
+  }
+  if (parts[0] !== 'M' || positions.length === 0) return true;
+  // a ply out of sequence means the file was replaced by a new game: start over
+  if (Number(parts[1]) !== positions.length) return false;
+  const board = positions[positions.length - 1].slice();
+  for (const change of parts.slice(3)) {
+    const i = (change.charCodeAt(1) - 49) * 8 + (change.charCodeAt(0) - 97);
+    board[i] = change[2];
+  }
+  positions.push(board);
+  return true;
+}
+
 async function loadGame() {
   try {
-    const res = await fetch('game.json', {cache:'no-store'});
+    const res = await fetch('game.feed', {cache:'no-store', headers:{'Range':`bytes=${offset}-`}});
+    if (res.status === 416) {
+      // nothing new, unless the file is now shorter than what we have read
+      const size = Number((res.headers.get('Content-Range') || '').split('/')[1]);
+      if (size < offset) resetFeed();
+      return;
+    }
     if (!res.ok) return;
-    const data = await res.json();
-    if (!data.positions) return;
-    // positions is array of arrays
-    positions = data.positions;
-    if (current >= positions.length) current = positions.length - 1;
+    let text = await res.text();
+    // servers without range support send the whole file
+    if (res.status === 200) {
+      if (text.length < offset) { resetFeed(); return; }
+      text = text.slice(offset);
+    }
+    const wasLast = current === positions.length - 1;
+    const end = text.lastIndexOf('\n') + 1;
+    let pos = 0;
+    while (pos < end) {
+      const nl = text.indexOf('\n', pos);
+      if (!applyRecord(text.slice(pos, nl))) { resetFeed(); return; }
+      pos = nl + 1;
+    }
+    offset += end; // the feed is ASCII, so characters are bytes
+    if (end === 0) return;
+    if (wasLast || current >= positions.length) current = positions.length - 1;
     renderIndex(current);
   } catch (e) {
-    console.error('failed to load game.json', e);
+    console.error('failed to load game.feed', e);
   }
 }
 
@@ -53,6 +100,68 @@ document.addEventListener('keydown', (e) => {
   if (e.key === 'ArrowRight') document.getElementById('next').click();
 });
 
-// poll game.json in case the C++ program writes new positions
-loadGame();
-setInterval(loadGame, 1000);
+// Served by the engine (--serve): moves are pushed over Server-Sent Events, one record per
+// event, and the game list comes from /games. Otherwise poll game.feed on disk.
+let source = null;
+let followed = 0; // bumped by every follow(), so a superseded one gives up after its await
+
+// "latest" is resolved to a game id before the stream opens: a reconnecting EventSource
+// resumes by record number, which only makes sense within one game
+async function follow(id) {
+  const token = ++followed;
+  if (source) source.close();
+  source = null;
+  positions = [];
+  current = 0;
+  if (id === '') {
+    const res = await fetch('games', {cache:'no-store'});
+    const data = res.ok ? await res.json() : {games: []};
+    if (token !== followed) return;
+    if (data.games.length === 0) { setTimeout(() => { if (token === followed) follow(''); }, 1000); return; }
+    id = String(data.games[data.games.length - 1].id);
+  }
+  source = new EventSource(`events?game=${id}`);
+  source.onmessage = (e) => {
+    const wasLast = current === positions.length - 1;
+    // a record out of sequence: replay the game from its start on a fresh stream
+    if (!applyRecord(e.data)) { follow(id); return; }
+    if (wasLast || current >= positions.length) current = positions.length - 1;
+    renderIndex(current);
+  };
+}
+
+async function loadGameList() {
+  const res = await fetch('games', {cache:'no-store'});
+  if (!res.ok) return false;
+  const data = await res.json();
+  const select = document.getElementById('game');
+  const chosen = select.value;
+  select.innerHTML = '<option value="">latest</option>';
+  for (const g of data.games) {
+    const opt = document.createElement('option');
+    opt.value = g.id;
+    opt.textContent = `game ${g.id + 1} (${g.plies} plies, ${g.result})`;
+    select.appendChild(opt);
+  }
+  select.value = chosen;
+  select.hidden = false;
+  return true;
+}
+
+async function start() {
+  try {
+    if (await loadGameList()) {
+      const select = document.getElementById('game');
+      select.addEventListener('focus', loadGameList);
+      select.addEventListener('change', () => follow(select.value));
+      follow(new URLSearchParams(location.search).get('game') || '');
+      return;
+    }
+  } catch (e) {
+    // not served by the engine
+  }
+  loadGame();
+  setInterval(loadGame, 1000);
+}
+
+start();